@@ -35,6 +35,7 @@
 #include "gcode_parse.h"
 #include "gcode_process.h"
 #include "serial.h"
+#include "settings.h"
 
 
 #ifndef FEATURE
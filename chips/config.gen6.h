@@ -96,9 +96,6 @@
 */
 // #define	SLOW_HOMING
 
-/// this is how many steps to suck back the filament by when we stop. set to zero to disable
-#define	E_STARTSTOP_STEPS			20
-
 /**
 	Soft axis limits, in mm.
 	Define them to your machine's size relative to what your host considers to be the origin.
@@ -145,11 +142,29 @@
 #define ACCELERATION_RAMPING
 
 /** \def ACCELERATION
-	how fast to accelerate when using ACCELERATION_RAMPING.
+	how fast to accelerate when using ACCELERATION_RAMPING or ACCELERATION_SCURVE.
 		given in mm/s^2, decimal allowed, useful range 1. to 10'000. Start with 10. for milling (high precision) or 1000. for printing
 */
 #define ACCELERATION 1000.
 
+/** \def ACCELERATION_SCURVE
+	jerk limited acceleration.
+		Like ACCELERATION_RAMPING, but acceleration doesn't jump to its full value at the start and end of each ramp, it builds up and fades out limited by JERK. Moves take slightly longer, but the frame rings a lot less, which often allows a higher ACCELERATION. Uses ACCELERATION, too. Comment out ACCELERATION_RAMPING when you define this, only one acceleration mode may be defined.
+*/
+// #define ACCELERATION_SCURVE
+
+/** \def JERK
+	how fast acceleration may change when using ACCELERATION_SCURVE.
+		given in mm/s^3, decimal allowed. ACCELERATION / JERK is the time it takes to build up full acceleration, 20'000. with an ACCELERATION of 1000. gives 50 ms.
+*/
+#define JERK 20000.
+
+/** \def MULTISTEP_RATE
+	step rate above which more than one step is done per step interrupt.
+		given in steps/s. Faster than this, 2, 4 or up to 8 steps are sent at once with a proportionally longer interval, which saves most of the interrupt overhead and allows higher step rates. Slowing down switches back smoothly. Comment out to always do one step per interrupt.
+*/
+#define MULTISTEP_RATE 10000
+
 /** \def ACCELERATION_TEMPORAL
 	temporal step algorithm
 		This algorithm causes the timer to fire when any axis needs to step, instead of synchronising to the axis with the most steps ala bresenham.
@@ -444,8 +459,8 @@ PWM value for 'off'
 #define	PID_SCALE						1024L
 
 /** \def ENDSTOP_STEPS
-	number of steps to run into the endstops intentionally
-		As Endstops trigger false alarm sometimes, Teacup debounces them by counting a number of consecutive positives. Valid range is 1...255. Use 4 or less for reliable endstops, 8 or even more for flaky ones.
+	number of consecutive reads an endstop has to be triggered for
+		As Endstops trigger false alarm sometimes, Teacup debounces them. Once an endstop reads triggered, the axis holds its next step and reads it again every 250 us. The move ends after this many triggered reads in a row, without running into the switch, a clear read in between lets it go on. Valid range is 1...255. Use 4 or less for reliable endstops, 8 or even more for flaky ones.
 */
 #define	ENDSTOP_STEPS	4
 
@@ -1,5 +1,10 @@
 #include "common.h"
 #include "core.h"
+#include <avr/interrupt.h>
+#include "memory_barrier.h"
+
+/// handlers per event. Features register at most one each, settings, debug and power another three
+#define MAX_FUNCS (FEATURES_COUNT + 3)
 
 event_func  core_events[MAX_EVENT][MAX_FUNCS];
 
@@ -12,7 +17,9 @@ int core_register(core_event_type type, event_func core_event){
 			return 0;
 		}
 	}
-	sersendf_P(PSTR("ERROR: core_register table for %d is full\n"), type);
+	// a missing handler silently drops gcodes, better not run at all
+	sersendf_P(PSTR("!! core_register: table for %d is full\n"), type);
+	core_emergency_stop();
 	return 1;
 }
 
@@ -26,3 +33,39 @@ void core_emit(core_event_type type, void *userdata){
 	}
 }
 
+
+/// set once core_emergency_stop() ran, nothing switches outputs on again after that
+volatile uint8_t core_stopped = 0;
+
+/** \brief switch off heaters and steppers now, safe to call from interrupts
+
+	Handlers of EVENT_EMERGENCY_STOP run with interrupts disabled and must neither wait nor print,
+	so this takes a bounded time. Reporting and halting is left to core_halt(), which the main
+	loop calls from clock_poll().
+*/
+void core_emergency_stop(void){
+	uint8_t sreg_save = SREG;
+
+	cli();
+	if(!core_stopped){
+		core_stopped = 1;
+		core_emit(EVENT_EMERGENCY_STOP, 0);
+	}
+	MEMORY_BARRIER();
+	SREG = sreg_save;
+}
+
+/// report the state after an emergency stop, then stay here until reset
+void core_halt(void){
+	core_emergency_stop();
+
+	// all interrupts but serial ones are off by now, the report needs them
+	sei();
+	serial_writestr_P(PSTR("\n!! emergency stop\n"));
+	core_emit(EVENT_EMERGENCY_REPORT, 0);
+	serial_writechar('\n');
+
+	// keep a watchdog fed, so the report stays readable
+	for (;;)
+		core_emit(EVENT_TICK, 0);
+}
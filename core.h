@@ -1,20 +1,26 @@
 #ifndef CORE_H
 #define CORE_H
 
-#define MAX_FUNCS 7
-
 typedef void (*event_func)(void *userdata);
 
 typedef enum core_event_type {
 	EVENT_INIT,
-	EVENT_TICK,
-	EVENT_TICK_10MS,
+	EVENT_TICK,          ///< every main loop iteration
+	EVENT_TICK_10MS,     ///< control loop clock, emitted from main loop
+	EVENT_TICK_250MS,
+	EVENT_TICK_1S,
 	EVENT_GCODE_PROCESS,
+	EVENT_EMERGENCY_STOP,  ///< switch everything off, emitted with interrupts disabled, maybe from an interrupt
+	EVENT_EMERGENCY_REPORT,///< tell the host the state after an emergency stop, emitted once from the main loop
 
 	MAX_EVENT,
 } core_event_type;
 
+extern volatile uint8_t core_stopped;
+
 int  core_register(core_event_type type, event_func core_event);
 void core_emit(core_event_type type, void *userdata);
+void core_emergency_stop(void);
+void core_halt(void) __attribute__ ((noreturn));
 
 #endif
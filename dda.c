@@ -30,15 +30,33 @@
 
 //#include "graycode.c"
 
+/// how often the step interrupt checks the condition of a wait token at the head of a queue
+#define	DDA_WAIT_POLL	10 MS
+
+/// speed override, DDA_SPEED_ONE / percent * 100 in 4.12 fixed point, see dda_set_speed()
+#define	DDA_SPEED_ONE	4096
+static volatile uint16_t dda_speed_factor = DDA_SPEED_ONE;
+static uint16_t          dda_speed_percent = 100;
+
+/// most steps pressure advance may run ahead
+#define	DDA_ADVANCE_MAX	1000
+/// step interval giving back pressure advance once the queue ran empty
+#define	DDA_ADVANCE_RELEASE	1 MS
+
+/// dda_queue_t.backlash_dir before anything was queued, no backlash to take up yet
+#define	DDA_DIRECTION_UNKNOWN	2
+
+#ifdef MULTISTEP_RATE
+/// step interrupt interval below which steps get bundled
+#define	MULTISTEP_C	(F_CPU / MULTISTEP_RATE)
+#endif
+
 /*! Distribute a new position_start to dda's internal structures without any movement.
 
 	This is needed for example after homing or a G92. The new location must be in position_start already.
 */
 
-void dda_create_acceleration_none(dda_t *dda, dda_target_t *position_start, dda_target_t *position_target){ // {{{
-	uint32_t	       target_st;
-	uint32_t               start_st;
-	
+void dda_create_acceleration_none(dda_queue_t *dda_queue, dda_t *dda, dda_target_t *position_start, dda_target_t *position_target, int32_t start_st, int32_t target_st){ // {{{
 	dda->allflags = 0;
 
 /* FIXME	if (target->e_relative) {
@@ -47,8 +65,6 @@ void dda_create_acceleration_none(dda_t *dda, dda_target_t *position_start, dda_
 		dda->direction = (target->E >= 0)?1:0;
 	}
 	else {*/
-		target_st        = um_to_steps_x(position_target->X);
-		start_st         = um_to_steps_x(position_start->X);
 		dda->delta_um    = (uint32_t)labs(position_target->X - position_start->X);
 		dda->delta_steps = (uint32_t)labs(target_st - start_st);
 		dda->direction   = (position_target->X >= position_start->X) ? 1 : 0;
@@ -84,23 +100,23 @@ void dda_create_acceleration_none(dda_t *dda, dda_target_t *position_start, dda_
 
 	One problem undoubtly arising is, steps should sometimes be done at {almost,exactly} the same time. We trust the timer to deal properly with very short or even zero periods. If a step can't be done in time, the timer shall do the step as soon as possible and compensate for the delay later. In turn we promise here to send a maximum of four such short-delays consecutively and to give sufficient time on average.
 */
-void dda_create_acceleration_temporal(dda_t *dda, dda_target_t *position_start, dda_target_t *position_target){ // {{{
+void dda_create_acceleration_temporal(dda_queue_t *dda_queue, dda_t *dda, dda_target_t *position_start, dda_target_t *position_target){ // {{{
 	// bracket part of this equation in an attempt to avoid overflow: 60 * 16MHz * 5mm is >32 bits
 	uint32_t move_duration = dda->delta_um * ((60 * F_CPU) / (position_target->F * 1000UL));
 	
 	dda->c = (move_duration / dda->delta_steps) << 8;
 } // }}}
 
-void dda_step_acceleration_temporal(dda_t *dda){ // {{{
+void dda_step_acceleration_temporal(dda_t *dda, uint8_t shift){ // {{{
 	// do nothing, dda->c is okay
 } // }}}
 #endif
 
 #ifdef ACCELERATION_RAMPING
-void dda_create_acceleration_ramping(dda_t *dda, dda_target_t *position_start, dda_target_t *position_target){ // {{{
+void dda_create_acceleration_ramping(dda_queue_t *dda_queue, dda_t *dda, dda_target_t *position_start, dda_target_t *position_target){ // {{{
 	
-	dda->move->ramping_n = 1;
-	dda->move->ramping_c = ((uint32_t)((double)F_CPU / sqrt((double)(STEPS_PER_M_X * ACCELERATION / 1000.)))) << 8;
+	// the move isn't running yet, dda_step() takes this over into the runtime data
+	dda->c = dda_queue->steps_ramp_c;
 	
 	// pre-calculate move speed in millimeter microseconds per step minute for less math in interrupt context
 	// mm (distance) * 60000000 us/min / step (delta) = mm.us per step.min
@@ -124,7 +140,7 @@ void dda_create_acceleration_ramping(dda_t *dda, dda_target_t *position_start, d
 	//dda->ramping_c_min = MAX(dda->ramping_c_min, c_limit);
 // This section is plain wrong, like in it's only half of what we need. This factor 960000 is dependant on STEPS_PER_MM.
 // overflows at position_target->F > 65535; factor 16. found by try-and-error; will overshoot target speed a bit
-	dda->rampup_steps = position_target->F * position_target->F / (uint32_t)(STEPS_PER_M_X * ACCELERATION / 960000.);
+	dda->rampup_steps = position_target->F * position_target->F / (uint32_t)(dda_queue->steps_per_m * ACCELERATION / 960000.);
 //sersendf_P(PSTR("rampup calc %lu\n"), dda->rampup_steps);
 	dda->rampup_steps = 100000; // replace mis-calculation by a safe value
 // End of wrong section.
@@ -133,7 +149,7 @@ void dda_create_acceleration_ramping(dda_t *dda, dda_target_t *position_start, d
 	dda->rampdown_steps = dda->delta_steps - dda->rampup_steps;
 } // }}}
 		
-void dda_step_acceleration_ramping(dda_t *dda){ // {{{
+void dda_step_acceleration_ramping(dda_t *dda, uint8_t shift){ // {{{
 	// - algorithm courtesy of http://www.embedded.com/columns/technicalinsights/56800129?printable=true
 	// - precalculate ramp lengths instead of counting them, see AVR446 tech note
 	uint8_t recalc_speed;
@@ -155,11 +171,11 @@ void dda_step_acceleration_ramping(dda_t *dda){ // {{{
 		recalc_speed = 1;
 	}
 	if (recalc_speed) {
-		dda->move->ramping_n += 4;
+		dda->move->ramping_n += 4 << shift;
 		// be careful of signedness!
-		dda->move->ramping_c = (int32_t)dda->move->ramping_c - ((int32_t)(dda->move->ramping_c * 2) / (int32_t)dda->move->ramping_n);
+		dda->move->ramping_c = (int32_t)dda->move->ramping_c - (((int32_t)(dda->move->ramping_c * 2) / (int32_t)dda->move->ramping_n) << shift);
 	}
-	dda->move->ramping_step_no++;
+	dda->move->ramping_step_no += 1 << shift;
 	// Print the number of steps actually needed for ramping up
 	// Needed for comparing the number with the one calculated in dda_create()
 	//static char printed = 0;
@@ -186,8 +202,153 @@ void dda_step_acceleration_ramping(dda_t *dda){ // {{{
 } // }}}
 #endif
 
+#ifdef ACCELERATION_SCURVE
+/** How does ACCELERATION SCURVE work?
+
+	Like ACCELERATION_RAMPING each move starts and ends at standstill. Instead of jumping to full acceleration, acceleration builds up with constant jerk, stays constant, then fades out until cruise speed is reached. Braking mirrors this. Up to seven phases, which saves the frame from the kicks at the corners of a trapezoidal speed profile.
+
+	dda_create() does all the planning with floats: peak acceleration, cruise speed reachable in the distance available and the step numbers where phases change. The step interrupt only integrates jerk and acceleration over the time of the last step with a few multiplies and finds the next step time with one Newton iteration on the reciprocal of speed, so there is no division per step.
+
+	Units are CPU ticks and steps, scaled to fit 32 bits: speed by 2^32, acceleration by 2^56, jerk by 2^80. Axes with many steps per meter, e.g. a Z leadscrew, would overflow that, dda_queue_set_steps() takes as many bits off acceleration and jerk as needed then.
+*/
+
+/// distance needed to accelerate from standstill to speed v with acceleration a and jerk j
+static float dda_scurve_distance(float v, float a, float j) {
+	if (v * j >= a * a)
+		return v * (v / a + a / j) / 2; // full acceleration is reached
+	else
+		return v * sqrt(v / j);
+}
+
+void dda_create_acceleration_scurve(dda_queue_t *dda_queue, dda_t *dda, dda_target_t *position_start, dda_target_t *position_target){ // {{{
+	// see dda_create_acceleration_none() on this one
+	uint32_t move_duration = ((dda->delta_um * 2400) / dda->delta_steps) * (F_CPU / 40000);
+	uint8_t  scale    = dda_queue->steps_scurve_scale;
+	float    a        = ldexp(dda_queue->steps_scurve_a, scale - 56);
+	float    j        = ldexp(dda_queue->steps_scurve_j, scale - 80);
+	float    c0       = dda_queue->steps_scurve_c;
+	float    half     = dda->delta_steps / 2.;
+	float    v_min    = j * c0 * c0 / 2;
+	float    v, t_j, t_a, a_peak, v1, s1, s2, s3;
+
+	// requested speed in steps per tick
+	v = (float)position_target->F / move_duration;
+
+	// speeding up and slowing down again have to fit into the move
+	if (dda_scurve_distance(v, a, j) > half) {
+		v = a / 2 * (sqrt(a * a / (j * j) + 8 * half / a) - a / j);
+		if (v * j < a * a)
+			v = cbrt(half * half * j);
+	}
+	if (v < v_min)
+		v = v_min;
+
+	if (v * j >= a * a) {
+		t_j    = a / j;
+		t_a    = v / a - t_j;
+		a_peak = a;
+	} else {
+		t_j    = sqrt(v / j);
+		t_a    = 0;
+		a_peak = j * t_j;
+	}
+
+	v1 = j * t_j * t_j / 2;
+	s1 = v1 * t_j / 3;
+	s2 = s1 + v1 * t_a + a_peak * t_a * t_a / 2;
+	s3 = v * (2 * t_j + t_a) / 2;
+
+	dda->scurve_s1    = s1 + .5;
+	dda->scurve_s2    = s2 + .5;
+	dda->scurve_s3    = s3 + .5;
+	dda->scurve_a_max = ldexp(a_peak, 56 - scale);
+	dda->scurve_v_max = ldexp(v, 32);
+	dda->scurve_v_min = ldexp(v_min, 32);
+	dda->scurve_j     = dda_queue->steps_scurve_j;
+	dda->scurve_scale = scale;
+
+	// time to the second step, dda_step_acceleration_scurve() takes over from there
+	dda->c = dda_queue->steps_scurve_c;
+} // }}}
+
+/*! step time for a speed
+	\param v speed, 2^-32 steps per tick
+	\param c step time for a similar speed, used as first guess
+	\return 1 / v in ticks
+
+	One Newton iteration c = c - c * (v * c - 1) if the guess is within 50%, which it is unless speed changes a lot from one step to the next, a division otherwise.
+*/
+static uint32_t dda_scurve_period(uint32_t v, uint32_t c) {
+	uint32_t hi = mul32x32_shr32(v, c);
+	uint32_t lo = v * c;
+
+	if (hi == 1 && lo < 0x80000000UL)
+		return c - mul32x32_shr32(c, lo);
+	if (hi == 0 && lo >= 0x80000000UL)
+		return c + mul32x32_shr32(c, -lo);
+	return 0xFFFFFFFFUL / v;
+}
+
+void dda_step_acceleration_scurve(dda_t *dda, uint8_t shift){ // {{{
+	dda_move_t            *move              = dda->move;
+	uint32_t               dt, jerk, a, dv, v;
+	uint8_t                decel;
+	uint32_t               step_no           = move->scurve_step_no;
+
+	move->scurve_step_no += 1 << shift;
+
+	// the first step is done at start, dda->c is the time to the second one already
+	if (step_no == 0)
+		return;
+
+	// time of the steps just done, scaled for mul32x32_shr32()
+	dt = dda->c << shift;
+	dt = (dt < 0x00FFFFFFUL) ? dt << 8 : 0xFFFFFF00UL;
+
+	decel = dda->delta_steps < dda->scurve_s3 && dda->delta_steps < move->scurve_step_no;
+
+	if (decel || move->scurve_step_no < dda->scurve_s3) {
+		jerk = mul32x32_shr32(dda->scurve_j, dt);
+		a    = move->scurve_a;
+
+		if (decel ? dda->delta_steps >= dda->scurve_s2 : move->scurve_step_no < dda->scurve_s1) {
+			// acceleration builds up
+			a += jerk;
+			if (a > dda->scurve_a_max)
+				a = dda->scurve_a_max;
+		}
+		else if (decel ? dda->delta_steps >= dda->scurve_s1 : move->scurve_step_no < dda->scurve_s2) {
+			a = dda->scurve_a_max;
+		}
+		else {
+			// acceleration fades out
+			a = (a > jerk) ? a - jerk : 0;
+		}
+
+		// trapezoidal integration, speed is exact while jerk is constant
+		dv = (mul32x32_shr32(move->scurve_a + a, dt) << dda->scurve_scale) >> 1;
+		v  = move->scurve_v;
+		if (decel)
+			v = (v > dda->scurve_v_min + dv) ? v - dv : dda->scurve_v_min;
+		else if ((v += dv) > dda->scurve_v_max)
+			v = dda->scurve_v_max;
+		else if (v < dda->scurve_v_min)
+			v = dda->scurve_v_min; // moves too short for any acceleration
+
+		move->scurve_a = a;
+		move->scurve_v = v;
+	}
+	else {
+		move->scurve_a = 0;
+		move->scurve_v = dda->scurve_v_max;
+	}
+
+	dda->c = dda_scurve_period(move->scurve_v, dda->c);
+} // }}}
+#endif
+
 #ifdef ACCELERATION_REPRAP
-void dda_create_acceleration_reprap(dda_t *dda, dda_target_t *position_start, dda_target_t *position_target){ // {{{
+void dda_create_acceleration_reprap(dda_queue_t *dda_queue, dda_t *dda, dda_target_t *position_start, dda_target_t *position_target){ // {{{
 	// pre-calculate move speed in millimeter microseconds per step minute for less math in interrupt context
 	// mm (distance) * 60000000 us/min / step (delta) = mm.us per step.min
 	//   note: um (distance) * 60000 == mm * 60000000
@@ -257,23 +418,23 @@ void dda_create_acceleration_reprap(dda_t *dda, dda_target_t *position_start, dd
 		dda->accel = 0;
 } // }}}
 
-void dda_step_acceleration_reprap(dda_t *dda){ // {{{
+void dda_step_acceleration_reprap(dda_t *dda, uint8_t shift){ // {{{
 	// linear acceleration magic, courtesy of http://www.embedded.com/columns/technicalinsights/56800129?printable=true
 	if (dda->accel) {
 		if ((dda->c > dda->reprap_end_c) && (dda->reprap_n > 0)) {
-			uint32_t new_c = dda->c - (dda->c * 2) / dda->reprap_n;
+			uint32_t new_c = dda->c - (((dda->c * 2) / dda->reprap_n) << shift);
 			if (new_c <= dda->c && new_c > dda->reprap_end_c) {
 				dda->c = new_c;
-				dda->reprap_n += 4;
+				dda->reprap_n += 4 << shift;
 			}
 			else
 				dda->c = dda->reprap_end_c;
 		}
 		else if ((dda->c < dda->reprap_end_c) && (dda->reprap_n < 0)) {
-			uint32_t new_c = dda->c + ((dda->c * 2) / -dda->reprap_n);
+			uint32_t new_c = dda->c + (((dda->c * 2) / -dda->reprap_n) << shift);
 			if (new_c >= dda->c && new_c < dda->reprap_end_c) {
 				dda->c = new_c;
-				dda->reprap_n += 4;
+				dda->reprap_n += 4 << shift;
 			}
 			else
 				dda->c = dda->reprap_end_c;
@@ -287,7 +448,20 @@ void dda_step_acceleration_reprap(dda_t *dda){ // {{{
 #endif
 
 
+/// reversing? The backlash is taken up by the first steps, as part of this move
+static void dda_backlash(dda_queue_t *dda_queue, dda_t *dda) {
+	dda->backlash_steps = 0;
+	if (dda_queue->backlash_steps && dda_queue->backlash_dir != DDA_DIRECTION_UNKNOWN &&
+	    dda_queue->backlash_dir != dda->direction) {
+		dda->backlash_steps  = dda_queue->backlash_steps;
+		dda->delta_steps    += dda_queue->backlash_steps;
+		dda->delta_um       += dda_queue->backlash_um;
+	}
+	dda_queue->backlash_dir = dda->direction;
+}
+
 /*! CREATE a dda given dda->position_current and a target, save to passed location so we can write directly into the queue
+	\param *dda_queue queue the move is for, supplies the axis' steps per meter
 	\param *dda pointer to a dda_queue_t entry to overwrite
 	\param *target the target position of this move
 
@@ -297,17 +471,27 @@ void dda_step_acceleration_reprap(dda_t *dda){ // {{{
 
 	This algorithm is probably the main limiting factor to print speed in terms of firmware limitations
 */
-uint8_t dda_create(dda_t *dda, dda_target_t *position_start, dda_target_t *position_target) {
-	if(position_target->X == position_start->X)
-		return 1; // ERR, nothing to move
+uint8_t dda_create(dda_queue_t *dda_queue, dda_t *dda, dda_target_t *position_start, dda_target_t *position_target) {
+	int32_t                target_st         = um_to_steps(position_target->X, dda_queue->steps_qn, dda_queue->steps_rn, dda_queue->steps_fn);
+	int32_t                start_st          = um_to_steps(position_start->X,  dda_queue->steps_qn, dda_queue->steps_rn, dda_queue->steps_fn);
+	
+	if(target_st == start_st)
+		return 1; // ERR, nothing to move. Entries without steps are dwells
+	
+	dda->wait = 0;
+	dda_create_acceleration_none(dda_queue, dda, position_start, position_target, start_st, target_st);
+	
+	// before the ramp is calculated, so it includes the backlash
+	dda_backlash(dda_queue, dda);
 	
-	dda_create_acceleration_none(dda, position_start, position_target);
 	#if defined ACCELERATION_REPRAP
-		dda_create_acceleration_reprap(dda, position_start, position_target);
+		dda_create_acceleration_reprap(dda_queue, dda, position_start, position_target);
 	#elif defined ACCELERATION_RAMPING
-		dda_create_acceleration_ramping(dda, position_start, position_target);
+		dda_create_acceleration_ramping(dda_queue, dda, position_start, position_target);
+	#elif defined ACCELERATION_SCURVE
+		dda_create_acceleration_scurve(dda_queue, dda, position_start, position_target);
 	#elif defined ACCELERATION_TEMPORAL
-		dda_create_acceleration_temporal(dda, position_start, position_target);
+		dda_create_acceleration_temporal(dda_queue, dda, position_start, position_target);
 	#endif
 
 	//c_limit = ((dda->delta_um * 2400L) / dda->delta_steps * (F_CPU / 40000) / MAXIMUM_FEEDRATE_X) << 8; // wtf?
@@ -321,13 +505,161 @@ uint8_t dda_create(dda_t *dda, dda_target_t *position_start, dda_target_t *posit
 	return 0;
 }
 
+#ifdef MULTISTEP_RATE
+/*! how many steps to do in this interrupt
+	\return log2 of the number of steps, 0 to 3
+
+	Steps are bundled as long as the time to the next interrupt is shorter than at MULTISTEP_RATE. One more or one less step shift per interrupt only, and a factor 3 hysteresis, so changes are smooth and don't toggle.
+*/
+static uint8_t dda_multistep_shift(dda_t *dda) {
+	uint8_t                shift             = dda->move->step_shift;
+	uint32_t               interval          = dda->c << shift;
+
+	if (interval < MULTISTEP_C) {
+		if (shift < 3)
+			shift++;
+	}
+	else if (shift && interval >= 3 * MULTISTEP_C)
+		shift--;
+
+	// never step beyond the end of the move, nor beyond an endstop
+	if (dda->endstop)
+		shift = 0;
+	while (shift && ((uint32_t)1 << shift) > dda->delta_steps)
+		shift--;
+
+	dda->move->step_shift = shift;
+	return shift;
+}
+#endif
+
+/** \brief set the speed override
+	\param percent speed of all moves in percent of the requested one, DDA_SPEED_MIN to DDA_SPEED_MAX
+
+	Takes effect on the next step, for queued moves and the running one alike. All axes run
+	their moves stretched or squeezed in time by the same factor, so they stay in sync.
+*/
+void dda_set_speed(uint16_t percent) {
+	uint16_t factor;
+	uint8_t  sreg_save;
+	
+	if (percent < DDA_SPEED_MIN)
+		percent = DDA_SPEED_MIN;
+	if (percent > DDA_SPEED_MAX)
+		percent = DDA_SPEED_MAX;
+	
+	dda_speed_percent = percent;
+	factor            = (DDA_SPEED_ONE * 100UL + percent / 2) / percent;
+	
+	sreg_save = SREG;
+	cli();
+	dda_speed_factor = factor;
+	MEMORY_BARRIER();
+	SREG = sreg_save;
+}
+
+/// the speed override in percent
+uint16_t dda_get_speed(void) {
+	return dda_speed_percent;
+}
+
+/// step interval with the speed override applied, one 32 x 16 bit multiply
+static uint32_t dda_speed(uint32_t c) {
+	uint16_t factor = dda_speed_factor;
+	
+	if (factor == DDA_SPEED_ONE)
+		return c;
+	if (c < 0x10000000UL)
+		return mul32x16_shr16(c << 4, factor);
+	return mul32x16_shr16(c, factor) << 4;
+}
+
+/// advance >= n * c, without overflowing. Two 16 x 16 bit multiplies, no division
+static uint8_t dda_advance_covers(uint32_t advance, uint32_t c, uint16_t n) {
+	uint32_t               hi                = mul16x16((uint16_t)(c >> 16), n);
+	uint32_t               product;
+	
+	if (hi >> 16)
+		return 0;
+	product = (hi << 16) + mul16x16((uint16_t)c, n);
+	if (product < (hi << 16))
+		return 0;
+	return advance >= product;
+}
+
+/** \brief pressure advance, run ahead of a move by advance times its speed
+	\param c time of one step of this order, speed override applied
+
+	Filament in the nozzle gets compressed when extrusion speeds up and relaxes when it slows down.
+	Running the extruder ahead of the move by a time constant makes up for this: the advance in
+	steps is advance / c. It follows the ramps of the move one step per interrupt, adding a step
+	when speeding up and holding one back when slowing down, so the move keeps its step count.
+	Moves backwards (retracts) give the advance back with extra steps.
+
+	advance / c isn't calculated, a step ahead is due while advance >= (advance_steps + 1) * c,
+	a step back while advance < advance_steps * c. That's multiplies only in the interrupt.
+*/
+static void dda_step_advance(dda_t *dda, dda_order_t *order, uint32_t c) {
+	dda_move_t            *move              = dda->move;
+	uint16_t               steps             = move->advance_steps;
+	uint8_t                active            = move->advance && dda->direction && !dda->endstop && c;
+	
+	if (active && steps < DDA_ADVANCE_MAX && dda_advance_covers(move->advance, c, steps + 1)) {
+		order->steps++;
+		move->advance_steps++;
+	}
+	else if (steps && (!active || !dda_advance_covers(move->advance, c, steps))) {
+		if (dda->direction)
+			order->steps--;
+		else
+			order->steps++;
+		move->advance_steps--;
+	}
+	
+	if (order->steps == 0)
+		order->step = 0;
+}
+
 /*! dda step routine, caltulate order to stepper and next time to call
  */
 void dda_step(dda_t *dda, dda_order_t *order) {
+	uint8_t                shift             = 0;
+	
+	if(dda->wait){
+		// wait token: we're done when the condition says so, until then check back regularly
+		order->callme    = 1;
+		if(dda->wait(dda->wait_arg)){
+			dda->status  = DDA_FINISHED;
+			order->c     = 0;
+		}else{
+			dda->status  = DDA_RUNNING;
+			order->c     = dda->c ? dda->c : DDA_WAIT_POLL;
+		}
+		return;
+	}
+	
+	if(dda->delta_steps == 0){
+		// dwell: nothing to step, next entry starts c ticks from now
+		dda->status      = DDA_FINISHED;
+		order->callme    = 1;
+		order->c         = dda->c;
+		return;
+	}
+	
 	switch(dda->status){
 		case DDA_READY:
 			#ifdef ACCELERATION_RAMPING
 				dda->move->ramping_step_no = 0;
+				dda->move->ramping_n       = 1;
+				dda->move->ramping_c       = dda->c;
+			#endif
+			#ifdef ACCELERATION_SCURVE
+				dda->move->scurve_step_no = 0;
+				dda->move->scurve_v       = 0;
+				dda->move->scurve_a       = 0;
+			#endif
+			#ifdef MULTISTEP_RATE
+				dda->move->step_shift     = 0;
 			#endif
 			
 			dda->status = DDA_RUNNING;
@@ -337,14 +669,19 @@ void dda_step(dda_t *dda, dda_order_t *order) {
 			break;
 			
 		case DDA_RUNNING:
-			dda->delta_steps--;
+			#ifdef MULTISTEP_RATE
+				shift = dda_multistep_shift(dda);
+			#endif
+			dda->delta_steps -= 1 << shift;
 			
 			#if defined ACCELERATION_REPRAP
-				dda_step_acceleration_reprap(dda);
+				dda_step_acceleration_reprap(dda, shift);
 			#elif defined ACCELERATION_RAMPING
-				dda_step_acceleration_ramping(dda);
+				dda_step_acceleration_ramping(dda, shift);
+			#elif defined ACCELERATION_SCURVE
+				dda_step_acceleration_scurve(dda, shift);
 			#elif defined ACCELERATION_TEMPORAL
-				dda_step_acceleration_temporal(dda);
+				dda_step_acceleration_temporal(dda, shift);
 			#endif
 			
 			// If there are no steps left, we have finished.
@@ -354,10 +691,22 @@ void dda_step(dda_t *dda, dda_order_t *order) {
 			}
 			
 			order->callme    = 1;                // ask for call
-			order->c         = dda->c;           // next time to call
+			order->c         = dda->c << shift;  // next time to call, dda->c is per step
+			if (!dda->endstop)
+				order->c     = dda_speed(order->c); // homing ignores the speed override
 			
 			order->step      = 1;                // ask for step
+			order->steps     = 1 << shift;       // this many at once
 			order->direction = dda->direction;   // in this direction
+			order->endstop   = dda->endstop;     // looking for the endstop
+			
+			if (dda->move->advance || dda->move->advance_steps)
+				dda_step_advance(dda, order, order->c >> shift);
+			
+			if (dda->backlash_steps && order->step) {
+				order->backlash      = (dda->backlash_steps < order->steps) ? dda->backlash_steps : order->steps;
+				dda->backlash_steps -= order->backlash;
+			}
 			break;
 		
 		case DDA_FINISHED:
@@ -366,6 +715,78 @@ void dda_step(dda_t *dda, dda_order_t *order) {
 }
 
 
+/// steps done so far, without waiting for the queue to empty
+int32_t dda_queue_position(dda_queue_t *dda_queue) {
+	int32_t  position;
+	uint8_t  sreg_save = SREG;
+	
+	// atomic 32-bit copy, the step interrupt updates it
+	cli();
+	position = dda_queue->position_steps;
+	MEMORY_BARRIER();
+	SREG = sreg_save;
+	
+	return position;
+}
+
+/// set the step counter, e.g. after homing. Moves still queued would make it wrong.
+void dda_queue_set_position(dda_queue_t *dda_queue, int32_t steps) {
+	uint8_t  sreg_save = SREG;
+	
+	cli();
+	dda_queue->position_steps = steps;
+	MEMORY_BARRIER();
+	SREG = sreg_save;
+}
+
+/*! end the running move without further steps, the next entry starts right away
+
+	Called by the axis from its step interrupt when an endstop triggers. The move slot isn't
+	touched from outside of interrupts while it's live, so no locking needed.
+*/
+void dda_queue_stop(dda_queue_t *dda_queue) {
+	dda_t                 *dda_curr          = &dda_queue->movebuffer[ dda_queue_curr_item() ];
+	
+	if(dda_curr->status == DDA_RUNNING)
+		dda_curr->status = DDA_FINISHED;
+}
+
+/*! set pressure advance of the axis driven by this queue
+	\param advance time the axis runs ahead of its moves, in CPU ticks. 0 - off
+
+	Only useful for extruders. Applies to the running move, too. Steps already ahead are given
+	back gradually as moves slow down.
+*/
+void dda_queue_set_advance(dda_queue_t *dda_queue, uint32_t advance) {
+	uint8_t  sreg_save = SREG;
+	
+	cli();
+	dda_queue->move.advance = advance;
+	MEMORY_BARRIER();
+	SREG = sreg_save;
+}
+
+/*! set the backlash of the axis driven by this queue
+	\param backlash_um play to take up when a move goes the other way than the one before, in um. 0 - off
+
+	Such moves get backlash_um longer, with the extra steps at their start. Nothing else gets
+	queued for it and the ramps cover the extra steps, too.
+*/
+void dda_queue_set_backlash(dda_queue_t *dda_queue, uint32_t backlash_um) {
+	dda_queue->backlash_um    = backlash_um;
+	dda_queue->backlash_steps = um_to_steps(backlash_um, dda_queue->steps_qn, dda_queue->steps_rn, dda_queue->steps_fn);
+}
+
+/// drop all entries including the running one, for an emergency stop. Call with interrupts disabled.
+void dda_queue_flush(dda_queue_t *dda_queue) {
+	uint8_t i;
+	
+	for(i=0; i<MOVEBUFFER_SIZE; i++){
+		dda_queue->movebuffer[i].status = DDA_FINISHED;
+	}
+	dda_queue->mb_tail = dda_queue->mb_head;
+}
+
 /// DEBUG - print queue.
 /// Qt/hs format, t is tail, h is head, s is F/full, E/empty or neither
 void dda_queue_debug_print(dda_queue_t *dda_queue) {
@@ -381,9 +802,52 @@ void dda_queue_init(dda_queue_t *dda_queue){
 	for(i=0; i<MOVEBUFFER_SIZE; i++){
 		dda_queue->movebuffer[i].status = DDA_FINISHED;
 	}
+	dda_queue->position_steps      = 0;
+	dda_queue->move.advance        = 0;
+	dda_queue->move.advance_steps  = 0;
+	dda_queue->backlash_um         = 0;
+	dda_queue->backlash_dir        = DDA_DIRECTION_UNKNOWN;
+	dda_queue_set_steps(dda_queue, 0);
 	MEMORY_BARRIER();
 }
 
+/*! set steps per meter of the axis driven by this queue
+	\param steps_per_m new value
+
+	Does all the division so dda_create() doesn't have to. Moves already queued keep their steps.
+*/
+void dda_queue_set_steps(dda_queue_t *dda_queue, uint32_t steps_per_m){
+	dda_queue->steps_per_m  = steps_per_m;
+	dda_queue->steps_qn     = steps_per_m / 1000000UL;
+	dda_queue->steps_rn     = steps_per_m % 1000000UL;
+	dda_queue->steps_fn     = reciprocal32(dda_queue->steps_rn, 1000000UL);
+	dda_queue_set_backlash(dda_queue, dda_queue->backlash_um);
+	#ifdef ACCELERATION_RAMPING
+	if(steps_per_m)
+		dda_queue->steps_ramp_c = ((uint32_t)((double)F_CPU / sqrt((double)steps_per_m * ACCELERATION / 1000.))) << 8;
+	#endif
+	#ifdef ACCELERATION_SCURVE
+	if(steps_per_m){
+		double  a     = ldexp((double)steps_per_m * ACCELERATION / 1000. / F_CPU / F_CPU, 56);
+		double  j     = ldexp((double)steps_per_m * JERK / 1000. / F_CPU / F_CPU / F_CPU, 80);
+		uint8_t scale = 0;
+		
+		// twice the acceleration has to fit 32 bits, see dda_step_acceleration_scurve(). Rather lose
+		// a few bits of resolution than clamp, which would make the axis accelerate slower than set
+		while((a >= 0x7FFFFFFFUL || j >= 0xFFFFFFFFUL) && scale < 16){
+			a /= 2;
+			j /= 2;
+			scale++;
+		}
+		dda_queue->steps_scurve_scale = scale;
+		dda_queue->steps_scurve_a     = (a < 0x7FFFFFFFUL) ? a : 0x7FFFFFFFUL;
+		dda_queue->steps_scurve_j     = (j < 0xFFFFFFFFUL) ? j : 0xFFFFFFFFUL;
+		// one step from standstill with constant jerk takes cbrt(6 / jerk)
+		dda_queue->steps_scurve_c     = cbrt(6. / ldexp(dda_queue->steps_scurve_j, scale - 80));
+	}
+	#endif
+}
+
 // -------------------------------------------------------
 // This is the one function called by the timer interrupt.
 // It calls a few other functions, though.
@@ -396,11 +860,21 @@ void dda_queue_step(dda_queue_t *dda_queue, dda_order_t *order) {
 	order->done      = 0;
 	order->callme    = 0;
 	order->step      = 0;
+	order->endstop   = 0;
+	order->backlash  = 0;
 	
 	switch(dda_curr->status){
 		case DDA_READY:  // do our steps
 		case DDA_RUNNING:
 			dda_step(dda_curr, order);
+			
+			// count steps as they are ordered, for the actual position. Backlash doesn't move the axis
+			if(order->step){
+				if(order->direction)
+					dda_queue->position_steps += order->steps - order->backlash;
+				else
+					dda_queue->position_steps -= order->steps - order->backlash;
+			}
 			break;
 			
 		case DDA_FINISHED: // goto next queued move
@@ -408,24 +882,122 @@ void dda_queue_step(dda_queue_t *dda_queue, dda_order_t *order) {
 				order->callme = 1;                 //   call me
 				order->c      = 0;                 //   as soon as possible
 			}
+			else if(dda_queue->move.advance_steps > 0){
+				// standing still, there's no pressure to make up for any more
+				dda_queue->move.advance_steps--;
+				dda_queue->position_steps--;
+				order->callme    = 1;
+				order->c         = DDA_ADVANCE_RELEASE;
+				order->step      = 1;
+				order->steps     = 1;
+				order->direction = 0;
+			}
 			break;
 	}
 }
 
+/// copy an entry into the movebuffer, waiting for free space if needed
+static void dda_queue_put(dda_queue_t *dda_queue, dda_t *dda_new) {
+	dda_t                 *dda_curr          = &dda_queue->movebuffer[ dda_queue_curr_space() ];
+	
+	dda_new->move = &dda_queue->move;
+	*dda_curr = *dda_new;
+
+	// keep control loops running while we wait for free space
+	while(dda_queue_push() != 0)
+		clock_poll();
+}
+
 /// add a move to the movebuffer
 void dda_queue_enqueue(dda_queue_t *dda_queue, dda_target_t *start, dda_target_t *target) {
 	dda_t                  dda_new;
-	dda_t                 *dda_curr          = &dda_queue->movebuffer[ dda_queue_curr_space() ];
 	
-	if( dda_create(&dda_new, start, target) != 0) // null move
+	if( dda_create(dda_queue, &dda_new, start, target) != 0) // null move
 		return;
 	
 	if(DEBUG_DDA && (debug_flags & DEBUG_DDA))
 		sersendf_P(PSTR("dda_enqueue: x:%ld f:%ld, slot:%d\r\n"), target->X, target->F, dda_queue_curr_space() );
 	
-	*dda_curr = dda_new;
+	dda_queue_put(dda_queue, &dda_new);
+}
 
-	while(dda_queue_push() != 0)
-		_delay_ms(WAITING_DELAY);
+/*! add a homing move to the movebuffer
+
+	Like dda_queue_enqueue(), but the move is done one step per interrupt and the axis is asked
+	to check the endstop in direction of the move before each step, see dda_order_t.endstop.
+*/
+void dda_queue_enqueue_endstop(dda_queue_t *dda_queue, dda_target_t *start, dda_target_t *target) {
+	dda_t                  dda_new;
+	
+	if( dda_create(dda_queue, &dda_new, start, target) != 0) // null move
+		return;
+	
+	dda_new.endstop = 1;
+	
+	if(DEBUG_DDA && (debug_flags & DEBUG_DDA))
+		sersendf_P(PSTR("dda_enqueue_endstop: x:%ld f:%ld, slot:%d\r\n"), target->X, target->F, dda_queue_curr_space() );
+	
+	dda_queue_put(dda_queue, &dda_new);
+}
+
+/*! precalculate a move for dda_queue_enqueue_dda()
+	\param *dda filled with the move
+	\return 0 on success, 1 for a null move
+
+	For moves queued over and over again, e.g. retracts. All the maths of dda_create() is done
+	once, with the steps per meter of the queue now. The move is prepared without backlash,
+	dda_queue_enqueue_dda() adds it when the move reverses.
+*/
+uint8_t dda_queue_prepare(dda_queue_t *dda_queue, dda_t *dda, dda_target_t *start, dda_target_t *target) {
+	uint8_t                direction         = dda_queue->backlash_dir;
+	uint8_t                null_move;
+	
+	// nothing known about the moves queued before this one
+	dda_queue->backlash_dir = DDA_DIRECTION_UNKNOWN;
+	null_move = dda_create(dda_queue, dda, start, target);
+	dda_queue->backlash_dir = direction;
+	
+	return null_move;
+}
+
+/// add a move precalculated by dda_queue_prepare(), a copy of it goes into the movebuffer
+void dda_queue_enqueue_dda(dda_queue_t *dda_queue, const dda_t *dda) {
+	dda_t                  dda_new           = *dda;
+	
+	// extra steps at the start only make the part at full speed longer, so the ramps hold.
+	// ACCELERATION_RAMPING counts where to slow down from the start, move that along
+	dda_backlash(dda_queue, &dda_new);
+	#ifdef ACCELERATION_RAMPING
+		dda_new.rampdown_steps += dda_new.backlash_steps;
+	#endif
+	
+	if(DEBUG_DDA && (debug_flags & DEBUG_DDA))
+		sersendf_P(PSTR("dda_enqueue_dda: steps:%lu, slot:%d\r\n"), dda_new.delta_steps, dda_queue_curr_space() );
+	
+	dda_queue_put(dda_queue, &dda_new);
+}
+
+/*! add a wait token or a dwell to the movebuffer
+	\param wait condition to wait for, polled from the step interrupt. 0 - dwell only
+	\param arg argument for wait
+	\param dwell time to pause in CPU ticks if wait is 0, else how often to poll wait, 0 - DDA_WAIT_POLL
+
+	Entries behind the token don't start before it's done. The main loop keeps running meanwhile.
+*/
+void dda_queue_enqueue_wait(dda_queue_t *dda_queue, dda_wait_func wait, uint8_t arg, uint32_t dwell) {
+	dda_t                  dda_new;
+	
+	dda_new.allflags    = 0;
+	dda_new.delta_um    = 0;
+	dda_new.delta_steps = 0;
+	dda_new.c           = dwell;
+	dda_new.wait        = wait;
+	dda_new.wait_arg    = arg;
+	dda_new.status      = DDA_READY;
+	
+	if(DEBUG_DDA && (debug_flags & DEBUG_DDA))
+		sersendf_P(PSTR("dda_enqueue_wait: c:%lu, slot:%d\r\n"), dwell, dda_queue_curr_space() );
+	
+	dda_queue_put(dda_queue, &dda_new);
 }
 
@@ -1,6 +1,10 @@
 #ifndef	_DDA_H
 #define	_DDA_H
 
+#if (defined ACCELERATION_REPRAP) + (defined ACCELERATION_RAMPING) + (defined ACCELERATION_SCURVE) + (defined ACCELERATION_TEMPORAL) > 1
+	#error more than one acceleration mode defined in config.h, comment out all but one
+#endif
+
 /*
 	types
 */
@@ -23,12 +27,25 @@ typedef struct {
 	uint32_t					F;
 } dda_target_t;
 
+/// condition of a wait token, polled from the step interrupt until it returns non-zero
+typedef uint8_t (*dda_wait_func)(uint8_t arg);
+
 typedef struct dda_move_t {
 	#ifdef ACCELERATION_RAMPING
 	uint32_t               ramping_step_no;            ///< counts actual steps done
 	uint32_t               ramping_c;                  ///< time until next step
 	int32_t                ramping_n;                  ///< tracking variable
 	#endif
+	#ifdef ACCELERATION_SCURVE
+	uint32_t               scurve_step_no;             ///< counts actual steps done
+	uint32_t               scurve_v;                   ///< current speed, 2^-32 steps per tick
+	uint32_t               scurve_a;                   ///< current acceleration, 2^-(56 - scurve_scale) steps per tick^2
+	#endif
+	#ifdef MULTISTEP_RATE
+	uint8_t                step_shift;                 ///< log2 of steps done per interrupt
+	#endif
+	uint32_t               advance;                    ///< pressure advance in CPU ticks, 0 - off. See dda_queue_set_advance()
+	uint16_t               advance_steps;              ///< steps the axis is ahead of the moves because of pressure advance, never behind
 } dda_move_t;
 
 /**
@@ -44,6 +61,7 @@ typedef struct dda_t {
 	union {
 		struct {
 			uint8_t						direction		:1; ///< direction flag for axis
+			uint8_t						endstop			:1; ///< homing move, ends early when the endstop in direction triggers
 			
 			#ifdef ACCELERATION_REPRAP
 			uint8_t						accel					:1; ///< bool: speed changes during this move, run accel code
@@ -56,6 +74,7 @@ typedef struct dda_t {
 	uint32_t					delta_um; ///< number of um on axis to do
 	uint32_t					delta_steps; ///< number of steps on axis to do
 	uint32_t					c; ///< time until next step, 24.8 fixed point
+	uint16_t					backlash_steps; ///< steps at the start taking up backlash, they don't change the position
 
 	#ifdef ACCELERATION_REPRAP
 	uint32_t					reprap_end_c; ///< time between 2nd last step and last step
@@ -66,8 +85,21 @@ typedef struct dda_t {
 	uint32_t					rampdown_steps; ///< number of last step before decelerating
 	uint32_t					ramping_c_min; ///< 24.8 fixed point timer value, maximum speed
 	#endif
+	#ifdef ACCELERATION_SCURVE
+	uint32_t					scurve_s1; ///< steps while acceleration builds up, same while it fades out at the end
+	uint32_t					scurve_s2; ///< steps until constant acceleration ends, counted from the nearer end of the move
+	uint32_t					scurve_s3; ///< steps until full speed is reached, counted from the nearer end of the move
+	uint32_t					scurve_a_max; ///< peak acceleration, 2^-(56 - scurve_scale) steps per tick^2
+	uint32_t					scurve_v_max; ///< cruise speed, 2^-32 steps per tick
+	uint32_t					scurve_v_min; ///< speed after the first step, 2^-32 steps per tick
+	uint32_t					scurve_j; ///< jerk, 2^-(80 - scurve_scale) steps per tick^3
+	uint8_t						scurve_scale; ///< bits acceleration and jerk are scaled down by to fit 32 bits, see dda_queue_set_steps()
+	#endif
 	
 	dda_move_t                                     *move;
+
+	dda_wait_func                                   wait; ///< wait token condition, 0 - move or dwell. A dwell is an entry without steps, waiting c ticks
+	uint8_t                                         wait_arg; ///< argument passed to wait
 } dda_t; // 354 bytes for 8 steps-ahead queue
 
 typedef struct dda_queue_t {
@@ -88,6 +120,32 @@ typedef struct dda_queue_t {
 	/// is no longer live.
 	/// The size does not need to be a power of 2 anymore!
 	dda_t movebuffer[MOVEBUFFER_SIZE]; ///< this is the ringbuffer that holds the current and pending moves.
+	
+	/// um to steps conversion, precalculated by dda_queue_set_steps() so
+	/// dda_create() can use muldivQRF() without dividing
+	uint32_t steps_per_m; ///< steps per meter of the axis driven by this queue
+	uint32_t steps_qn;    ///< steps_per_m / 1000000
+	uint32_t steps_rn;    ///< steps_per_m % 1000000
+	uint32_t steps_fn;    ///< steps_rn * 2^32 / 1000000, see muldivQRF()
+	uint32_t backlash_um;    ///< play of the axis, taken up when a move reverses. See dda_queue_set_backlash()
+	uint16_t backlash_steps; ///< backlash_um in steps
+	uint8_t  backlash_dir;   ///< direction of the last move queued, DDA_DIRECTION_UNKNOWN before the first
+	#ifdef ACCELERATION_RAMPING
+	uint32_t steps_ramp_c; ///< 24.8 fixed point time of the first step of a ramp
+	#endif
+	#ifdef ACCELERATION_SCURVE
+	uint32_t steps_scurve_a; ///< ACCELERATION in 2^-(56 - steps_scurve_scale) steps per tick^2
+	uint32_t steps_scurve_j; ///< JERK in 2^-(80 - steps_scurve_scale) steps per tick^3
+	uint32_t steps_scurve_c; ///< time from standstill to the second step, in ticks
+	uint8_t  steps_scurve_scale; ///< bits steps_scurve_a and steps_scurve_j are scaled down by to fit 32 bits
+	#endif
+	
+	/// runtime data of the move currently executing, the only one needing it
+	dda_move_t move;
+	
+	/// steps done since start, the actual position of the axis.
+	/// written in interrupts only, read it with dda_queue_position()
+	volatile int32_t position_steps;
 } dda_queue_t;
 
 typedef struct dda_order_t {
@@ -96,9 +154,16 @@ typedef struct dda_order_t {
 	uint8_t                done      :1;  ///< we are done!
 	
 	uint32_t               c;             ///< time until next step
+	uint8_t                steps;         ///< number of steps to do at once, 1 unless MULTISTEP_RATE is exceeded
 	uint8_t                direction :1;  ///< direction to step
+	uint8_t                endstop   :1;  ///< check the endstop in direction before the next step, stop the move with dda_queue_stop()
+	uint8_t                backlash;      ///< steps of this order taking up backlash, they don't change the position
 } dda_order_t;
 
+/// range of the speed override, in percent
+#define	DDA_SPEED_MIN	10
+#define	DDA_SPEED_MAX	1000
+
 /*
 	methods
 */
@@ -109,13 +174,50 @@ uint8_t dda_queue_empty(dda_queue_t *queue);
 
 void dda_queue_init(dda_queue_t *queue);
 
+// set steps per meter for all moves enqueued from now on
+void dda_queue_set_steps(dda_queue_t *queue, uint32_t steps_per_m);
+
 // print queue status
 void dda_queue_debug_print(dda_queue_t *queue);
 
 // add a new target to the queue
 void dda_queue_enqueue(dda_queue_t *queue, dda_target_t *start, dda_target_t *t);
 
+// add a homing move, running until the endstop triggers or target is reached
+void dda_queue_enqueue_endstop(dda_queue_t *queue, dda_target_t *start, dda_target_t *t);
+
+// precalculate a move, to be added with dda_queue_enqueue_dda() as often as needed
+uint8_t dda_queue_prepare(dda_queue_t *queue, dda_t *dda, dda_target_t *start, dda_target_t *t);
+
+// add a move precalculated by dda_queue_prepare()
+void dda_queue_enqueue_dda(dda_queue_t *queue, const dda_t *dda);
+
+// add a wait token or a dwell to the queue
+void dda_queue_enqueue_wait(dda_queue_t *queue, dda_wait_func wait, uint8_t arg, uint32_t dwell);
+
 // take one step
 void dda_queue_step(dda_queue_t *queue, dda_order_t *order);
 
+// steps done so far, safe to call outside of interrupts
+int32_t dda_queue_position(dda_queue_t *queue);
+
+// set the step counter, only while the queue is empty
+void dda_queue_set_position(dda_queue_t *queue, int32_t steps);
+
+// end the running move now, from the step interrupt
+void dda_queue_stop(dda_queue_t *queue);
+
+// drop every entry, with interrupts disabled
+void dda_queue_flush(dda_queue_t *queue);
+
+// pressure advance of the axis, applies from the next step on
+void dda_queue_set_advance(dda_queue_t *queue, uint32_t advance);
+
+// backlash of the axis, applies to moves enqueued from now on
+void dda_queue_set_backlash(dda_queue_t *queue, uint32_t backlash_um);
+
+// speed override of all queues in percent, applies from the next step on
+void     dda_set_speed(uint16_t percent);
+uint16_t dda_get_speed(void);
+
 #endif	/* _dda_queue_t */
@@ -63,6 +63,120 @@ const int32_t muldivQR(int32_t multiplicand, uint32_t qn, uint32_t rn,
   return negative_flag ? -((int32_t)quotient) : (int32_t)quotient;
 }
 
+/*!
+  lower 32 bits of a 24 x 16 bit multiply
+  \param a multiplicand, must fit into 24 bits
+  \param b multiplier
+  \return a * b, truncated to 32 bits
+
+  The upper partial product is only 8 x 16 bits.
+*/
+uint32_t mul24x16(uint32_t a, uint16_t b) {
+  return (mul16x16((uint8_t)(a >> 16), b) << 16) + mul16x16((uint16_t)a, b);
+}
+
+/*!
+  lower 32 bits of a 32 x 16 bit multiply
+  \param a multiplicand
+  \param b multiplier
+  \return a * b, truncated to 32 bits
+*/
+uint32_t mul32x16(uint32_t a, uint16_t b) {
+  return (mul16x16((uint16_t)(a >> 16), b) << 16) + mul16x16((uint16_t)a, b);
+}
+
+/*!
+  32 x 16 bit fixed point multiply
+  \param a multiplicand
+  \param b multiplier, 0.16 fixed point
+  \return a * b / 2^16, rounded down
+
+  Exact, as the high partial product needs no shifting at all.
+*/
+uint32_t mul32x16_shr16(uint32_t a, uint16_t b) {
+  return mul16x16((uint16_t)(a >> 16), b) + (mul16x16((uint16_t)a, b) >> 16);
+}
+
+/*!
+  upper 32 bits of a 32 x 32 bit multiply
+  \param a multiplicand
+  \param b multiplier
+  \return a * b / 2^32, rounded down
+
+  Four 16 x 16 bit partial products, carries of the lower ones are summed up
+  separately, so the result is exact.
+*/
+uint32_t mul32x32_shr32(uint32_t a, uint32_t b) {
+  uint32_t hh = mul16x16((uint16_t)(a >> 16), (uint16_t)(b >> 16));
+  uint32_t hl = mul16x16((uint16_t)(a >> 16), (uint16_t)b);
+  uint32_t lh = mul16x16((uint16_t)a, (uint16_t)(b >> 16));
+  uint32_t ll = mul16x16((uint16_t)a, (uint16_t)b);
+  uint32_t mid = (ll >> 16) + (hl & 0xFFFF) + (lh & 0xFFFF);
+
+  return hh + (hl >> 16) + (lh >> 16) + (mid >> 16);
+}
+
+/*!
+  reciprocal for division by multiplication
+  \param n numerator, must be smaller than divisor
+  \param divisor must be smaller than 2^31
+  \return n * 2^32 / divisor, rounded down
+
+  One bit per iteration, so this is as slow as muldivQR(). Call it once when
+  the divisor changes, not for every calculation.
+*/
+uint32_t reciprocal32(uint32_t n, uint32_t divisor) {
+  uint32_t fraction = 0;
+  uint8_t i;
+
+  for (i = 0; i < 32; i++) {
+    n <<= 1;
+    fraction <<= 1;
+    if (n >= divisor) {
+      n -= divisor;
+      fraction |= 1;
+    }
+  }
+  return fraction;
+}
+
+/*!
+  Integer multiply-divide using the hardware multiplier. Returns exactly the same as muldivQR(multiplicand, qn, rn, divisor).
+
+  \param multiplicand
+  \param qn ( = multiplier / divisor ), must fit into 16 bits
+  \param rn ( = multiplier % divisor )
+  \param fn ( = reciprocal32(rn, divisor) )
+  \param divisor must be smaller than 2^31
+  \return rounded result of multiplicand * multiplier / divisor
+
+  The quotient of multiplicand * rn / divisor is estimated by multiplying with
+  the reciprocal. As fn is rounded down the estimate is at most one too small.
+  The remainder, calculated modulo 2^32, tells whether it is, and is needed for
+  rounding anyways.
+*/
+const int32_t muldivQRF(int32_t multiplicand, uint32_t qn, uint32_t rn,
+                        uint32_t fn, uint32_t divisor) {
+  uint32_t quotient, fraction, remainder;
+  uint32_t a = multiplicand < 0 ? -(uint32_t)multiplicand : (uint32_t)multiplicand;
+
+  quotient = mul32x16(a, (uint16_t)qn);
+  fraction = mul32x32_shr32(a, fn);
+  remainder = a * rn - fraction * divisor;
+
+  if (remainder >= divisor) {
+    fraction++;
+    remainder -= divisor;
+  }
+
+  // rounding, same as in muldivQR()
+  if (remainder > divisor / 2)
+    fraction++;
+
+  quotient += fraction;
+  return multiplicand < 0 ? -((int32_t)quotient) : (int32_t)quotient;
+}
+
 // courtesy of http://www.flipcode.com/archives/Fast_Approximate_Distance_Functions.shtml
 /*! linear approximation 2d distance formula
   \param dx distance in X plane
@@ -158,6 +272,33 @@ uint16_t int_sqrt(uint32_t a) {
   return (uint16_t) ((root >> 1) & 0xFFFFL);
 }
 
+/*!
+  integer square root of a 64 bit number, same algorithm as int_sqrt()
+  \param a find square root of this number
+  \return sqrt(a - 1) < returnvalue <= sqrt(a)
+
+  For squares of lengths in um, e.g. the diagonal rods of a delta printer.
+*/
+uint32_t int_sqrt64(uint64_t a) {
+  uint64_t rem = 0;
+  uint64_t root = 0;
+  uint8_t i;
+
+  for (i = 0; i < 32; i++) {
+    root <<= 1;
+    rem = ((rem << 2) + (a >> 62));
+    a <<= 2;
+    root++;
+    if (root <= rem) {
+      rem -= root;
+      root++;
+    }
+    else
+      root--;
+  }
+  return (uint32_t) (root >> 1);
+}
+
 // this is an ultra-crude pseudo-logarithm routine, such that:
 // 2 ^ msbloc(v) >= v
 /*! crude logarithm algorithm
@@ -3,8 +3,6 @@
 
 #include	<stdint.h>
 
-#include	"config.h"
-
 // return rounded result of multiplicand * multiplier / divisor
 // this version is with quotient and remainder precalculated elsewhere
 const int32_t muldivQR(int32_t multiplicand, uint32_t qn, uint32_t rn,
@@ -19,35 +17,47 @@ inline int32_t muldiv(int32_t multiplicand, uint32_t multiplier,
 }
 
 /*
-	micrometer distance <=> motor step distance conversions
+	fixed point multiplies built from 16 x 16 -> 32 bit products, which
+	compile to the hardware multiplier on ATmegas. Each of them is exact.
 */
-// Like shown in the patch attached to this post:
-// http://forums.reprap.org/read.php?147,89710,130225#msg-130225 ,
-// it might be worth pre-calculating muldivQR()'s qn and rn in dda_init()
-// as soon as STEPS_PER_M_{XYZE} is no longer a compile-time variable.
 
-static int32_t um_to_steps_x(int32_t) __attribute__ ((always_inline));
-inline int32_t um_to_steps_x(int32_t distance) {
-    return muldivQR(distance, STEPS_PER_M_X / 1000000UL,
-                    STEPS_PER_M_X % 1000000UL, 1000000UL);
+// 16 x 16 -> 32 bit, the building block for everything below
+static uint32_t mul16x16(uint16_t, uint16_t) __attribute__ ((always_inline));
+inline uint32_t mul16x16(uint16_t a, uint16_t b) {
+  return (uint32_t)a * b;
 }
 
-static int32_t um_to_steps_y(int32_t) __attribute__ ((always_inline));
-inline int32_t um_to_steps_y(int32_t distance) {
-    return muldivQR(distance, STEPS_PER_M_Y / 1000000UL,
-                    STEPS_PER_M_Y % 1000000UL, 1000000UL);
-}
+// lower 32 bits of a * b, a must fit into 24 bits
+uint32_t mul24x16(uint32_t a, uint16_t b);
 
-static int32_t um_to_steps_z(int32_t) __attribute__ ((always_inline));
-inline int32_t um_to_steps_z(int32_t distance) {
-    return muldivQR(distance, STEPS_PER_M_Z / 1000000UL,
-                    STEPS_PER_M_Z % 1000000UL, 1000000UL);
-}
+// lower 32 bits of a * b
+uint32_t mul32x16(uint32_t a, uint16_t b);
+
+// a * b / 2^16, result must fit into 32 bits
+uint32_t mul32x16_shr16(uint32_t a, uint16_t b);
+
+// a * b / 2^32
+uint32_t mul32x32_shr32(uint32_t a, uint32_t b);
+
+// n * 2^32 / divisor for n < divisor, the reciprocal used by muldivQRF()
+uint32_t reciprocal32(uint32_t n, uint32_t divisor);
 
-static int32_t um_to_steps_e(int32_t) __attribute__ ((always_inline));
-inline int32_t um_to_steps_e(int32_t distance) {
-    return muldivQR(distance, STEPS_PER_M_E / 1000000UL,
-                    STEPS_PER_M_E % 1000000UL, 1000000UL);
+// muldivQR() with the remainder multiplied by a precalculated reciprocal
+// fn = reciprocal32(rn, divisor) instead of looping over all bits
+const int32_t muldivQRF(int32_t multiplicand, uint32_t qn, uint32_t rn,
+                        uint32_t fn, uint32_t divisor);
+
+/*
+	micrometer distance <=> motor step distance conversions
+*/
+// Like shown in the patch attached to this post:
+// http://forums.reprap.org/read.php?147,89710,130225#msg-130225 ,
+// muldivQR()'s qn and rn as well as the reciprocal of rn are pre-calculated
+// for runtime steps per meter, see dda_queue_set_steps().
+
+static int32_t um_to_steps(int32_t, uint32_t, uint32_t, uint32_t) __attribute__ ((always_inline));
+inline int32_t um_to_steps(int32_t distance, uint32_t qn, uint32_t rn, uint32_t fn) {
+    return muldivQRF(distance, qn, rn, fn, 1000000UL);
 }
 
 // approximate 2D distance
@@ -59,6 +69,9 @@ uint32_t approx_distance_3(uint32_t dx, uint32_t dy, uint32_t dz);
 // integer square root algorithm
 uint16_t int_sqrt(uint32_t a);
 
+// integer square root of a 64 bit number
+uint32_t int_sqrt64(uint64_t a);
+
 // this is an ultra-crude pseudo-logarithm routine, such that:
 // 2 ^ msbloc(v) >= v
 const uint8_t msbloc (uint32_t v);
@@ -137,6 +137,17 @@ uint16_t	analog_read(uint8_t channel) {
 /*! Say to analog feature that we want to read this pin
  */
 void analog_usepin(uint8_t pin){
+	uint8_t                idle              = (analog_mask == 0);
+
 	analog_mask |= 1 << pin;
+
+	// analog_init() found nothing to read, so interrupt loop is not running yet
+	if(idle)
+		analog_init();
+
+	DIDR0 = analog_mask & 0xFF;
+	#ifdef	DIDR2
+		DIDR2 = (analog_mask >> 8) & 0xFF;
+	#endif
 }
 
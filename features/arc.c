@@ -0,0 +1,189 @@
+#define FEATURE
+#include	"common.h"
+#include	"axes.h"
+#include	<math.h>
+
+// CONFIGURATION
+#define ARC_CHORD_ERROR      10         // um, maximum distance between arc and the chords it's split into
+#define ARC_CORRECTION       25         // chords between exact recalculations of the position on the arc
+// END OF CONFIGURATION
+
+API void arc_init(void);
+
+/** \file
+	\brief G2/G3 arcs
+
+	An arc is split into chords short enough to stay within ARC_CHORD_ERROR of the real arc. Chords
+	are calculated one at a time and handed to the axes like a G1, so the next one is only calculated
+	once the previous one found a free movebuffer slot. A single arc command replaces hundreds of
+	G1 lines on the serial line.
+
+	Moving from one chord to the next is a rotation of the radius vector, done incrementally. Every
+	ARC_CORRECTION chords the position is calculated from scratch to stop rounding errors from
+	adding up.
+*/
+
+/// absolute target in um of an axis, current position if not given
+static int32_t arc_target(axis_t *axis, void *next_target){
+	int32_t                value;
+
+	if(!axis || !PARAMETER_SEEN(axis->letter))
+		return axis ? axis->runtime.position_curr : 0;
+
+	value = axis_parameter_um(axis, next_target, axis->letter);
+	if(axis->runtime.relative)
+		value += axis->runtime.position_curr;
+	else if(axis->runtime.offset)
+		value += *axis->runtime.offset;
+	return value;
+}
+
+/// queue one chord, Z and E only if they move during the arc
+static void arc_chord(void *next_target, float x, float y, float z, float e, uint8_t have_z, uint8_t have_e){
+	GCODE_COMMAND          chord;
+
+	chord.seen = 0;
+	PARAMETER_SET(&chord, L_G, 1);
+	PARAMETER_SET(&chord, L_X, lround(x));
+	PARAMETER_SET(&chord, L_Y, lround(y));
+	if(have_z)
+		PARAMETER_SET(&chord, L_Z, lround(z));
+	if(have_e)
+		PARAMETER_SET(&chord, L_E, lround(e));
+
+	// F is modal and stays in the parameters even if not seen
+	chord.parameters[L_F] = ((GCODE_COMMAND *)next_target)->parameters[L_F];
+
+	axes_move(&chord);
+}
+
+void arc_gcode_process(void *next_target){
+	axis_t                *ax, *ay, *az, *ae;
+	uint8_t                clockwise;
+	int32_t                start_x, start_y, start_z, start_e, end_x, end_y;
+	float                  i, j, radius, r_x, r_y, rs_x, rs_y, travel, step, sin_step, cos_step, z, e, dz, de, tmp;
+	uint16_t               segments, n;
+
+	if(!PARAMETER_SEEN(L_G))
+		return;
+
+	switch(PARAMETER_asint(L_G)){
+		case 2:
+			//? --- G2: Clockwise Arc ---
+			//?
+			//? Example: G2 X90.6 Y13.8 I5 J10 E22.4
+			//?
+			//? Move clockwise on an arc from the current position to X, Y, around the centre at
+			//? offset I, J from the current position. Instead of I and J the radius can be given
+			//? with R, negative for arcs of more than 180 degrees. Without X and Y (and with I, J)
+			//? this is a full circle. Z and E move linearly along the arc.
+			//?
+		case 3:
+			//? --- G3: Counter-Clockwise Arc ---
+			//?
+			//? Example: G3 X90.6 Y13.8 R20
+			//?
+			//? Same as G2, counter-clockwise.
+			//?
+			break;
+		default:
+			return;
+	}
+
+	ax = axes_find(L_X);
+	ay = axes_find(L_Y);
+	az = axes_find(L_Z);
+	ae = axes_find(L_E);
+	if(!ax || !ay)
+		return;
+
+	clockwise = (PARAMETER_asint(L_G) == 2);
+
+	start_x = ax->runtime.position_curr;
+	start_y = ay->runtime.position_curr;
+	start_z = az ? az->runtime.position_curr : 0;
+	start_e = ae ? ae->runtime.position_curr : 0;
+	end_x   = arc_target(ax, next_target);
+	end_y   = arc_target(ay, next_target);
+	dz      = arc_target(az, next_target) - start_z;
+	de      = arc_target(ae, next_target) - start_e;
+
+	if(PARAMETER_SEEN(L_R)){
+		// centre from radius, on the side given by direction and sign of R
+		float dx = end_x - start_x, dy = end_y - start_y;
+		float d2 = dx * dx + dy * dy;
+		float h;
+
+		radius = axis_parameter_um(ax, next_target, L_R);
+		if(d2 == 0 || 4 * radius * radius < d2){
+			serial_writestr_P(PSTR("arc: radius too small "));
+			return;
+		}
+		h = sqrt(4 * radius * radius - d2) / sqrt(d2);
+		if(clockwise)
+			h = -h;
+		if(radius < 0){
+			h = -h;
+			radius = -radius;
+		}
+		i = (dx - dy * h) / 2;
+		j = (dy + dx * h) / 2;
+	}else{
+		i = PARAMETER_SEEN(L_I) ? axis_parameter_um(ax, next_target, L_I) : 0;
+		j = PARAMETER_SEEN(L_J) ? axis_parameter_um(ay, next_target, L_J) : 0;
+		radius = sqrt(i * i + j * j);
+		if(radius == 0)
+			return;
+	}
+
+	// radius vectors of start and end, seen from the centre
+	rs_x = -i;
+	rs_y = -j;
+	r_x  = end_x - start_x - i;
+	r_y  = end_y - start_y - j;
+
+	travel = atan2(rs_x * r_y - rs_y * r_x, rs_x * r_x + rs_y * r_y);
+	if(clockwise){
+		if(travel >= -1e-6)
+			travel -= 2 * M_PI; // same start and end is a full circle
+	}else{
+		if(travel <= 1e-6)
+			travel += 2 * M_PI;
+	}
+
+	// a chord of length l is ARC_CHORD_ERROR off the arc when (l / 2)^2 = error * (2 * radius - error)
+	tmp = ARC_CHORD_ERROR * (2 * radius - ARC_CHORD_ERROR);
+	segments = (tmp > 0) ? ceil(fabs(travel) * radius / 2 / sqrt(tmp)) : 1;
+	if(segments == 0)
+		segments = 1;
+
+	step     = travel / segments;
+	sin_step = sin(step);
+	cos_step = cos(step);
+
+	r_x = rs_x;
+	r_y = rs_y;
+	for(n = 1; n < segments; n++){
+		if(n % ARC_CORRECTION){
+			tmp = r_x * cos_step - r_y * sin_step;
+			r_y = r_x * sin_step + r_y * cos_step;
+			r_x = tmp;
+		}else{
+			float sin_n = sin(n * step), cos_n = cos(n * step);
+
+			r_x = rs_x * cos_n - rs_y * sin_n;
+			r_y = rs_x * sin_n + rs_y * cos_n;
+		}
+
+		z = start_z + dz * n / segments;
+		e = start_e + de * n / segments;
+		arc_chord(next_target, start_x + i + r_x, start_y + j + r_y, z, e, dz != 0, de != 0);
+	}
+
+	// last chord ends exactly where requested
+	arc_chord(next_target, end_x, end_y, start_z + dz, start_e + de, dz != 0, de != 0);
+}
+
+void arc_init(void){
+	core_register(EVENT_GCODE_PROCESS, &arc_gcode_process);
+}
@@ -1,7 +1,29 @@
 #include "common.h"
 #include "axes.h"
+#include <avr/interrupt.h>
+#include "memory_barrier.h"
+#include "dda_maths.h"
+
+#define AXES_BARRIERS          4               ///< barriers queued at the same time, for up to 8 axes
+#define AXES_BARRIER_POLL      1 MS            ///< how often axes waiting at a barrier check it
+#define AXES_BACKLASH_MAX      2000            ///< um, largest backlash M425 accepts
+
+API typedef void (*axes_barrier_func)(uint8_t arg);
+API typedef void (*axes_move_func)(void *next_target);
 
 API void axes_init(void);
+API void axes_wait(dda_wait_func wait, uint8_t arg, uint32_t dwell);
+API void axes_barrier(axes_barrier_func callback, uint8_t arg);
+API void axes_barrier_wait(void);
+API void axes_move(void *next_target);
+API void axes_queue(void *next_target);
+API void axes_set_planner(axes_move_func planner);
+API void axes_queue_motors(void *next_target);
+API void axes_set_kinematics(const axes_kinematics_t *kinematics);
+API uint8_t axes_kinematic(axis_t *axis);
+API axis_t *axes_find(uint8_t letter);
+API int32_t axis_parameter_um(axis_t *axis, void *next_target, uint8_t letter);
+API uint32_t axis_steps_per_m(axis_t *axis);
 
 void axis_debug_print(axis_t *axis){
 	sersendf_P(PSTR(
@@ -10,6 +32,8 @@ void axis_debug_print(axis_t *axis){
 			"have_min: %d, have_max: %d, "
 			"feed_search: %lu, feed_max: %lu, "
 			"pos_min: %ld, pos_max: %ld, "
+			"steps_per_m: %lu, "
+			"backlash: %lu, "
 			"position: %ld, "
 			"relative: %d, "
 			"inches: %d"
@@ -19,6 +43,8 @@ void axis_debug_print(axis_t *axis){
 		axis->have_position_min, axis->have_position_max,
 		axis->feedrate_search,   axis->feedrate_max,
 		axis->position_min,      axis->position_max,
+		axis->steps_per_m,
+		axis->backlash,
 		axis->runtime.position_curr,
 		axis->runtime.relative,
 		axis->runtime.inches
@@ -35,21 +61,20 @@ void axis_gcode_universal(axis_t *axis, void *next_target){
 					break;
 
 				// convert coordinate to um with respect to current measurment mode
-				if(axis->runtime.inches){
-					PARAMETER_SET(next_target, axis->letter,
-						PARAMETER_asmult(axis->letter, 25400)
-					); 
-				}else{
-					PARAMETER_SET(next_target, axis->letter,
-						PARAMETER_asmult(axis->letter, 1000)
-					); 
-				}
+				PARAMETER_SET(next_target, axis->letter,
+					axis_parameter_um(axis, next_target, axis->letter)
+				);
 				
-				// if relative mode is on - convert relative coordinates to absolute
+				// if relative mode is on - convert relative coordinates to absolute,
+				// position_curr includes the tool offset already
 				if(axis->runtime.relative){
 					PARAMETER_SET(next_target, axis->letter,
 						axis->runtime.position_curr + PARAMETER_asint(axis->letter)
 					);
+				}else if(axis->runtime.offset){
+					PARAMETER_SET(next_target, axis->letter,
+						PARAMETER_asint(axis->letter) + *axis->runtime.offset
+					);
 				}
 				break;
 				
@@ -135,11 +160,56 @@ void axis_gcode_universal(axis_t *axis, void *next_target){
 					axis->runtime.relative = 1;
 				break;
 			
-			case 400:
-				//? --- M400 - Wait for all operations to complete (could be same as M116 but not sure)
-				// FIXME queue_wait();
+			case 92:
+				//? --- M92: set steps per unit ---
+				//?
+				//? Example: M92 X80 Z400
+				//?
+				//? Set steps per mm of the given axes, fractions are allowed. Applies to moves queued afterwards. Save with M500.
+				//?
+				if(PARAMETER_SEEN(axis->letter))
+					axis->steps_per_m = PARAMETER_asmult(axis->letter, 1000);
 				break;
-
+			
+			case 203:
+				//? --- M203: set maximum feedrate ---
+				//?
+				//? Example: M203 X6000 Z120
+				//?
+				//? Set the feedrate G0 moves the given axes at, in mm/min. Save with M500.
+				//?
+				if(PARAMETER_SEEN(axis->letter))
+					axis->feedrate_max = PARAMETER_asint(axis->letter);
+				break;
+			
+			case 208:
+				//? --- M208: set axis limits ---
+				//?
+				//? Example: M208 X200 Y180
+				//?
+				//? Set the maximum position of the given axes in mm, or with S1 the minimum position. Save with M500.
+				//?
+				if(PARAMETER_SEEN(axis->letter)){
+					if(PARAMETER_SEEN(L_S) && PARAMETER_asint(L_S))
+						axis->position_min = PARAMETER_asmult(axis->letter, 1000);
+					else
+						axis->position_max = PARAMETER_asmult(axis->letter, 1000);
+				}
+				break;
+			
+			case 425:
+				//? --- M425: set backlash ---
+				//?
+				//? Example: M425 Z0.08
+				//?
+				//? Set the play of the given axes in mm, up to 2 mm. Moves reversing direction take it
+				//? up with extra steps at their start, at the speed of the move. Applies to moves queued
+				//? afterwards. Without parameters the backlash of all axes is reported. Save with M500.
+				//?
+				if(PARAMETER_SEEN(axis->letter))
+					axis->backlash = constrain(PARAMETER_asmult(axis->letter, 1000), 0, AXES_BACKLASH_MAX);
+				break;
+			
 			#ifdef DEBUG
 			case 401:
 				//? --- M401 - Show debug info
@@ -150,135 +220,498 @@ void axis_gcode_universal(axis_t *axis, void *next_target){
 	}
 }
 
+/** \brief read a length parameter in um
+	\param letter parameter to read, needn't be the letter of the axis (I, J, R, ...)
+
+	Respects G20/G21 of this axis, not G90/G91.
+*/
+int32_t axis_parameter_um(axis_t *axis, void *next_target, uint8_t letter){
+	return PARAMETER_asmult(letter, axis->runtime.inches ? 25400 : 1000);
+}
+
+/// steps per meter to queue moves with, steps_per_m scaled by the flow override
+uint32_t axis_steps_per_m(axis_t *axis){
+	if(axis->runtime.flow == 100)
+		return axis->steps_per_m;
+	
+	return muldiv(axis->steps_per_m, axis->runtime.flow, 100);
+}
+
+/// find the axis driven by a letter, 0 if there is none
+axis_t *axes_find(uint8_t letter){
+	uint8_t                i;
+	
+	for(i=0; i<axes_count; i++){
+		if(axes[i].letter == letter)
+			return &axes[i];
+	}
+	return 0;
+}
+
 // This function is per-axis only
 void axis_gcode_letter(axis_t *axis, void *next_target){
 	axis->proto->func_gcode(axis, next_target);
 }
 
-void axes_gcode(void *next_target){
+#define AXES_HOME_MIN          0
+#define AXES_HOME_MAX          1
+#define AXES_HOME_ANY          2               ///< min endstop if there is one, else max endstop
+
+/// how coordinates map to motors, 0 - each axis drives its own motor
+static const axes_kinematics_t *axes_kinematics = 0;
+
+/// does the kinematics handle this axis? Other axes, e.g. E, drive their own motor
+uint8_t axes_kinematic(axis_t *axis){
+	return axes_kinematics && (axis->letter == L_X || axis->letter == L_Y || axis->letter == L_Z);
+}
+
+/// where an axis actually is (um), in coordinates, not motor positions. Returns 0 if unknown
+static uint8_t axes_position_actual(axis_t *axis, int32_t *position){
+	int32_t                xyz[3];
+	
+	if(axes_kinematic(axis)){
+		if(!axes_kinematics->position || !axes_kinematics->position(xyz))
+			return 0;
+		*position = xyz[axis->letter - L_X];
+		return 1;
+	}
+	
+	if(!axis->proto->func_position)
+		return 0;
+	*position = axis->proto->func_position(axis);
+	return 1;
+}
+
+/// print planned and actual position of all axes, in mm
+void axes_report_position(void){
 	uint8_t                i;
+	int32_t                position;
 	
+	for(i=0; i<axes_count; i++)
+		sersendf_P(PSTR("%c:%lq "), gcode_convert_letter(axes[i].letter), axes[i].runtime.position_curr);
+	
+	serial_writestr_P(PSTR("Count "));
 	for(i=0; i<axes_count; i++){
-		axis_gcode_universal(&axes[i], next_target);
+		if(axes_position_actual(&axes[i], &position))
+			sersendf_P(PSTR("%c:%lq "), gcode_convert_letter(axes[i].letter), position);
+	}
+}
+
+/// queue homing of one axis to its min (0) or max (1) endstop, returns 0 without that endstop
+static uint8_t axes_home_axis(axis_t *axis, uint8_t max){
+	if(axes_kinematic(axis))
+		return axes_kinematics->home(axis, max);
+	
+	if(!axis->proto->func_home)
+		return 0;
+	return axis->proto->func_home(axis, max, axis, 0);
+}
+
+/// homing of one axis is done and the queue is empty, take over the endstop position
+static void axes_homed_axis(axis_t *axis, uint8_t max){
+	if(axes_kinematic(axis)){
+		axes_kinematics->homed(axis, max);
+		return;
+	}
+	
+	axis->runtime.position_curr  = max ? axis->position_max : axis->position_min;
+	axis->runtime.position_motor = axis->runtime.position_curr;
+	if(axis->proto->func_set_position)
+		axis->proto->func_set_position(axis);
+}
+
+/** \brief home the axes seen in next_target, all if none is seen
+	\param where AXES_HOME_MIN, AXES_HOME_MAX or AXES_HOME_ANY
+
+	Axes home at the same time. Returns once all are done, the position of each homed axis is
+	then its position_min or position_max, unless the kinematics says otherwise.
+*/
+void axes_home(void *next_target, uint8_t where){
+	uint8_t                i;
+	uint8_t                any               = 0;
+	uint8_t                homed             = 0;
+	uint8_t                at_max            = 0;
+	
+	for(i=0; i<axes_count; i++){
+		if(PARAMETER_SEEN(axes[i].letter))
+			any = 1;
+	}
+	
+	for(i=0; i<axes_count; i++){
+		axis_t  *axis = &axes[i];
+		
+		if(any && !PARAMETER_SEEN(axis->letter))
+			continue;
 		
+		if(where != AXES_HOME_MAX && axes_home_axis(axis, 0)){
+			homed  |= 1 << i;
+		}else if(where != AXES_HOME_MIN && axes_home_axis(axis, 1)){
+			homed  |= 1 << i;
+			at_max |= 1 << i;
+		}
+	}
+	if(!homed)
+		return;
+	
+	axes_barrier_wait();
+	
+	for(i=0; i<axes_count; i++){
+		if(homed & (1 << i))
+			axes_homed_axis(&axes[i], (at_max & (1 << i)) ? 1 : 0);
+	}
+}
+
+void axes_gcode(void *next_target){
+	uint8_t                i;
+	uint8_t                move              = 0;
+	#ifdef DEBUG
+		int32_t                position;
+	#endif
+	
+	if(PARAMETER_SEEN(L_G))
+		move = (PARAMETER_asint(L_G) == 0 || PARAMETER_asint(L_G) == 1);
+	
+	for(i=0; i<axes_count; i++)
+		axis_gcode_universal(&axes[i], next_target);
+	
+	// coordinates are absolute and in um now
+	if(move){
+		axes_move(next_target);
+	}else{
+		for(i=0; i<axes_count; i++){
+			if(PARAMETER_SEEN(axes[i].letter))
+				axis_gcode_letter(&axes[i], next_target);
+		}
+	}
+	
+	if(PARAMETER_SEEN(L_G)){
+		switch(PARAMETER_asint(L_G)){
+			case 28:
+				//? --- G28: Home ---
+				//?
+				//? Example: G28
+				//?
+				//? This causes the RepRap machine to move back to its endstops, min endstops where there are any, else max endstops. It runs into them fast, backs off a bit, then moves back slowly to the stop. This ensures more accurate positioning.
+				//?
+				//? If you add coordinates, then just the axes with coordinates specified will be zeroed.  Thus
+				//?
+				//? G28 X0 Y72.3
+				//?
+				//? will zero the X and Y axes, but not Z.  The actual coordinate values are ignored.
+				//?
+				axes_home(next_target, AXES_HOME_ANY);
+				break;
+			
+			case 161:
+				//? --- G161: Home negative ---
+				//?
+				//? Find the minimum limit of the specified axes by searching for the limit switch.
+				//?
+				axes_home(next_target, AXES_HOME_MIN);
+				break;
+			
+			case 162:
+				//? --- G162: Home positive ---
+				//?
+				//? Find the maximum limit of the specified axes by searching for the limit switch.
+				//?
+				axes_home(next_target, AXES_HOME_MAX);
+				break;
+		}
+	}
+	
+	if(PARAMETER_SEEN(L_M)){
+		switch(PARAMETER_asint(L_M)){
+			case 114:
+				//? --- M114: Get Current Position ---
+				//?
+				//? Example: M114
+				//?
+				//? This causes the RepRap machine to report its current X, Y, Z and E coordinates to the host.
+				//?
+				//? For example, the machine returns a string such as:
+				//?
+				//?  <tt>ok X:100.000 Y:50.000 Z:0.300 E:12.520 Count X:81.372 Y:44.010 Z:0.300 E:10.114</tt>
+				//?
+				//? The first set is where the queued moves end, the set after Count is where the steppers
+				//? actually are right now. Doesn't wait for the queue, so hosts can poll it while moving.
+				//?
+				axes_report_position();
+				break;
+			
+			case 220:
+				//? --- M220: set speed override ---
+				//?
+				//? Example: M220 S120
+				//?
+				//? Run all moves at S percent of their feedrate, from 10 to 1000. Applies right away,
+				//? to the move running and all moves queued. Without S the current override is reported.
+				//?
+				if(PARAMETER_SEEN(L_S))
+					dda_set_speed(PARAMETER_asint(L_S));
+				else
+					sersendf_P(PSTR("FR:%u%% "), dda_get_speed());
+				break;
+			
+			case 221:
+				//? --- M221: set flow override ---
+				//?
+				//? Example: M221 S95
+				//?
+				//? Extrude S percent of the requested amount, from 10 to 1000. Applies to moves queued
+				//? afterwards. Without S the current override is reported.
+				//?
+				for(i=0; i<axes_count; i++){
+					if(axes[i].letter != L_E)
+						continue;
+					if(PARAMETER_SEEN(L_S))
+						axes[i].runtime.flow = constrain(PARAMETER_asint(L_S), DDA_SPEED_MIN, DDA_SPEED_MAX);
+					else
+						sersendf_P(PSTR("E:%u%% "), axes[i].runtime.flow);
+				}
+				break;
+			
+			case 425:
+				// see axis_gcode_universal(), report if no axis is given
+				for(i=0; i<axes_count; i++){
+					if(PARAMETER_SEEN(axes[i].letter))
+						break;
+				}
+				if(i == axes_count){
+					for(i=0; i<axes_count; i++)
+						sersendf_P(PSTR("%c:%lq "), gcode_convert_letter(axes[i].letter), axes[i].backlash);
+				}
+				break;
+			
+			case 400:
+				//? --- M400: Wait for all moves to complete ---
+				//?
+				//? Example: M400
+				//?
+				//? Commands after this one are processed once all axes finished the moves queued before.
+				//?
+				axes_barrier_wait();
+				break;
+			
+			#ifdef DEBUG
+			case 250:
+				//? --- M250: return current position, end position, queue ---
+				//? Undocumented
+				//? This command is only available in DEBUG builds.
+				for(i=0; i<axes_count; i++){
+					if(!axes_position_actual(&axes[i], &position))
+						position = axes[i].runtime.position_curr;
+					sersendf_P(PSTR("{%c:%ld,%ld}\t"), gcode_convert_letter(axes[i].letter),
+						position, axes[i].runtime.position_curr);
+				}
+				break;
+			#endif
+		}
+	}
+}
+
+/// the planner G0/G1 moves go through, 0 - straight to axes_queue()
+static axes_move_func  axes_planner = 0;
+
+/** \brief queue a move for all axes seen in target
+	\param next_target G0 or G1 command, coordinates already absolute and in um, F in mm/min
+
+	G0/G1 and moves calculated by the firmware itself, e.g. the chords of an arc, come here. They
+	go through the planner if there is one, which may split or correct them.
+*/
+void axes_move(void *next_target){
+	if(axes_planner)
+		axes_planner(next_target);
+	else
+		axes_queue(next_target);
+}
+
+/** \brief like axes_move(), but without the planner
+	\param next_target G0 or G1 command, coordinates absolute and in um
+
+	Coordinates go through the kinematics, if there is one, and position_curr of the axes seen
+	is updated. Nothing moves if the kinematics can't reach the target.
+*/
+void axes_queue(void *next_target){
+	uint8_t                i;
+	
+	if(axes_kinematics){
+		if(!axes_kinematics->move(next_target))
+			return;
+	}else{
+		axes_queue_motors(next_target);
+	}
+	
+	for(i=0; i<axes_count; i++){
+		if(PARAMETER_SEEN(axes[i].letter))
+			axes[i].runtime.position_curr = PARAMETER_asint(axes[i].letter);
+	}
+}
+
+/// queue a G0 or G1 move on the motors of all axes seen, coordinates are motor positions (um)
+void axes_queue_motors(void *next_target){
+	uint8_t                i;
+	
+	for(i=0; i<axes_count; i++){
 		if(PARAMETER_SEEN(axes[i].letter))
 			axis_gcode_letter(&axes[i], next_target);
 	}
 }
 
-void axes_init(void){
+/// make G0/G1 moves go through planner, which queues them with axes_queue()
+void axes_set_planner(axes_move_func planner){
+	axes_planner = planner;
+}
+
+/// map coordinates of moves and homing to motors with kinematics, see axes_kinematics_t
+void axes_set_kinematics(const axes_kinematics_t *kinematics){
+	axes_kinematics = kinematics;
+}
+
+/** \brief queue a wait token or dwell on every axis
+	\param wait condition polled until it returns non-zero, 0 - dwell only
+	\param arg argument passed to wait
+	\param dwell pause in CPU ticks if wait is 0, else how often to poll wait, 0 - default
+
+	Returns immediately, moves queued afterwards start once the token is done. Each axis polls
+	on its own, use axes_barrier() first if they have to start together.
+*/
+void axes_wait(dda_wait_func wait, uint8_t arg, uint32_t dwell){
 	uint8_t                i;
 	
-	core_register(EVENT_GCODE_PROCESS, &axes_gcode);
+	for(i=0; i<axes_count; i++){
+		if(axes[i].proto->func_wait)
+			axes[i].proto->func_wait(&axes[i], wait, arg, dwell);
+	}
+}
+
+/**
+	\brief barriers, wait tokens on all axes which release together
+
+	Each axis waiting at a barrier marks itself arrived. Once all have, the callback runs and
+	every axis carries on with its queue. The slot is free again after the last one left.
+*/
+typedef struct axes_barrier_t {
+	volatile uint8_t       arrived;              ///< axes which reached the barrier
+	volatile uint8_t       passed;               ///< axes which left it again
+	volatile uint8_t       expected;             ///< axes queuing barriers, 0 - slot unused
+	axes_barrier_func      callback;             ///< called once all arrived, 0 - none
+	uint8_t                arg;                  ///< argument for callback
+} axes_barrier_t;
+
+static axes_barrier_t    axes_barriers[AXES_BARRIERS];
+static volatile uint8_t  axes_idle;
+
+/// wait token condition of a barrier, arg is barrier number * 8 + axis number
+static uint8_t axes_barrier_reached(uint8_t arg){
+	axes_barrier_t        *barrier           = &axes_barriers[arg >> 3];
+	uint8_t                axis              = 1 << (arg & 7);
+	uint8_t                done              = 0;
+	uint8_t                sreg_save         = SREG;
+	
+	// step interrupts of other axes look at the same barrier
+	cli();
+	if(!(barrier->arrived & axis)){
+		barrier->arrived |= axis;
+		if(barrier->arrived == barrier->expected && barrier->callback)
+			barrier->callback(barrier->arg);
+	}
+	if(barrier->arrived == barrier->expected){
+		barrier->passed |= axis;
+		if(barrier->passed == barrier->expected)
+			barrier->expected = 0;
+		done = 1;
+	}
+	MEMORY_BARRIER();
+	SREG = sreg_save;
+	
+	return done;
+}
+
+/** \brief queue a barrier on every axis
+	\param callback called from the step interrupt once all axes reached the barrier, keep it short. 0 - none
+	\param arg argument passed to callback
+
+	Moves queued afterwards start on all axes at the same time, once every axis finished the
+	moves queued before. Returns immediately unless all AXES_BARRIERS are still in use.
+*/
+void axes_barrier(axes_barrier_func callback, uint8_t arg){
+	uint8_t                i, b;
+	uint8_t                expected          = 0;
 	
 	for(i=0; i<axes_count; i++){
-		axes[i].proto->func_init(&axes[i]);
+		if(axes[i].proto->func_wait)
+			expected |= 1 << i;
+	}
+	if(!expected){
+		if(callback)
+			callback(arg);
+		return;
+	}
+	
+	// all barriers in use, wait for the oldest to release
+	for(b=0; axes_barriers[b].expected; b = (b + 1) % AXES_BARRIERS){
+		if(b == AXES_BARRIERS - 1)
+			clock_poll();
+	}
+	
+	axes_barriers[b].arrived  = 0;
+	axes_barriers[b].passed   = 0;
+	axes_barriers[b].callback = callback;
+	axes_barriers[b].arg      = arg;
+	axes_barriers[b].expected = expected;
+	
+	for(i=0; i<axes_count; i++){
+		if(axes[i].proto->func_wait)
+			axes[i].proto->func_wait(&axes[i], &axes_barrier_reached, (b << 3) | i, AXES_BARRIER_POLL);
 	}
 }
 
-/*
-	uint8_t endstop_stop; ///< Stop due to endstop trigger
-	uint8_t endstop_not_done = 0; ///< Which axes haven't finished homing
-
-#if defined X_MIN_PIN || defined X_MAX_PIN
-	if (dda->endstop_check) {
-#if defined X_MIN_PIN
-		if (x_min() == dda->endstop_stop_cond)
-			dda->move->debounce_count_min++;
-		else
-			dda->move->debounce_count_min = 0;
-#endif
-
-#if defined X_MAX_PIN
-		if (x_max() == dda->endstop_stop_cond)
-			dda->move->debounce_count_max++;
-		else
-			dda->move->debounce_count_max = 0;
-#endif
-
-		endstop_stop = dda->move->debounce_count_min >= ENDSTOP_STEPS ||
-		               dda->move->debounce_count_max >= ENDSTOP_STEPS;
-		if (!endstop_stop)
-			endstop_not_done |= 0x1;
-	} else
-#endif
-		endstop_stop = 0;
-
-	#if defined Z_MIN_PIN
-		home_z_negative();
-	#elif defined	Z_MAX_PIN
-		home_z_positive();
-	#endif
-/// find Z MIN endstop
-void home_z_negative() {
-	#if defined Z_MIN_PIN
-		TARGET t = startpoint;
-
-		t.Z = -1000000;
-		#ifdef SLOW_HOMING
-			// hit home soft
-			t.F = SEARCH_FEEDRATE_Z;
-		#else
-			// hit home hard
-			t.F = MAXIMUM_FEEDRATE_Z;
-		#endif
-		enqueue_home(&t, 0x4, 1);
-
-		#ifndef SLOW_HOMING
-			// back off slowly
-			t.Z = +1000000;
-			t.F = SEARCH_FEEDRATE_Z;
-			enqueue_home(&t, 0x4, 0);
-		#endif
-
-		// set Z home
-		queue_wait();
-		#ifdef Z_MIN
-			startpoint.Z = next_target.target.Z = (int32_t)(Z_MIN * 1000.);
-		#else
-			startpoint.Z = next_target.target.Z = 0;
-		#endif
-		dda_new_startpoint(dda);
-		z_disable();
-	#endif
+static void axes_barrier_idle(uint8_t arg){
+	axes_idle = 1;
 }
 
-/// find Z MAX endstop
-void home_z_positive() {
-	#if defined Z_MAX_PIN && ! defined Z_MAX
-		#warning Z_MAX_PIN defined, but not Z_MAX. home_z_positive() disabled.
-	#endif
-	#if defined Z_MAX_PIN && defined Z_MAX
-		TARGET t = startpoint;
-
-		t.Z = +1000000;
-		#ifdef SLOW_HOMING
-			// hit home soft
-			t.F = SEARCH_FEEDRATE_Z;
-		#else
-			// hit home hard
-			t.F = MAXIMUM_FEEDRATE_Z;
-		#endif
-		enqueue_home(&t, 0x4, 1);
-
-		#ifndef SLOW_HOMING
-			// back off slowly
-			t.Z = -1000000;
-			t.F = SEARCH_FEEDRATE_Z;
-			enqueue_home(&t, 0x4, 0);
-		#endif
-
-		// set Z home
-		queue_wait();
-		// set position to MAX
-		startpoint.Z = next_target.target.Z = (int32_t)(Z_MAX * 1000.);
-		dda_new_startpoint(dda);
-		// go to zero
-		t.Z = 0;
-		t.F = MAXIMUM_FEEDRATE_Z;
-		enqueue(&t);
-	#endif
+/// wait until all moves queued so far are done
+void axes_barrier_wait(void){
+	axes_idle = 0;
+	axes_barrier(&axes_barrier_idle, 0);
+	
+	while(!axes_idle)
+		clock_poll();
+}
+
+/// emergency stop, in bounded time with interrupts disabled
+void axes_emergency_stop(void *data){
+	uint8_t                i;
+	
+	for(i=0; i<axes_count; i++){
+		if(axes[i].proto->func_stop)
+			axes[i].proto->func_stop(&axes[i]);
+	}
 }
+
+/// after an emergency stop, planned position shows what got lost
+void axes_emergency_report(void *data){
+	axes_report_position();
+}
+
+void axes_init(void){
+	uint8_t                i;
+	
+	core_register(EVENT_GCODE_PROCESS,    &axes_gcode);
+	core_register(EVENT_EMERGENCY_STOP,   &axes_emergency_stop);
+	core_register(EVENT_EMERGENCY_REPORT, &axes_emergency_report);
+	
+	for(i=0; i<axes_count; i++){
+		axes[i].runtime.flow = 100;
+		axes[i].proto->func_init(&axes[i]);
+		
+		settings_register(&axes[i].feedrate_search,
+			(uint8_t *)&axes[i].backlash + sizeof(axes[i].backlash) - (uint8_t *)&axes[i].feedrate_search, 0);
+	}
+}
+
+/*
 	switch (next_target.G) {
 		case 0:
 			//? G0: Rapid Linear Motion
@@ -303,68 +736,6 @@ void home_z_positive() {
 			enqueue(&next_target.target);
 			break;
 
-			//	G2 - Arc Clockwise
-			// unimplemented
-
-			//	G3 - Arc Counter-clockwise
-			// unimplemented
-
-
-		case 30:
-			//? --- G30: Go home via point ---
-			//?
-			//? Undocumented.
-			enqueue(&next_target.target);
-			// no break here, G30 is move and then go home
-
-		case 28:
-			//? --- G28: Home ---
-			//?
-			//? Example: G28
-			//?
-			//? This causes the RepRap machine to move back to its X, Y and Z zero endstops.  It does so accelerating, so as to get there fast.  But when it arrives it backs off by 1 mm in each direction slowly, then moves back slowly to the stop.  This ensures more accurate positioning.
-			//?
-			//? If you add coordinates, then just the axes with coordinates specified will be zeroed.  Thus
-			//?
-			//? G28 X0 Y72.3
-			//?
-			//? will zero the X and Y axes, but not Z.  The actual coordinate values are ignored.
-			//?
-
-			queue_wait();
-
-			if ((next_target.seen & (1<<L_X)) != 0) {
-				#if defined	X_MIN_PIN
-					home_x_negative();
-				#elif defined X_MAX_PIN
-					home_x_positive();
-				#endif
-				axisSelected = 1;
-			}
-			if ((next_target.seen & (1<<L_Y)) != 0) {
-				#if defined	Y_MIN_PIN
-					home_y_negative();
-				#elif defined Y_MAX_PIN
-					home_y_positive();
-				#endif
-				axisSelected = 1;
-			}
-			if ((next_target.seen & (1<<L_Z)) != 0) {
-				#if defined Z_MAX_PIN
-					home_z_positive();
-				#elif defined	Z_MIN_PIN
-					home_z_negative();
-				#endif
-				axisSelected = 1;
-			}
-			// there's no point in moving E, as E has no endstops
-
-			if (!axisSelected) {
-				home();
-			}
-			break;
-
-
 		case 92:
 			//? --- G92: Set Position ---
 			//?
@@ -402,70 +773,10 @@ void home_z_positive() {
 			dda_new_startpoint(dda);
 			break;
 
-		case 161:
-			//? --- G161: Home negative ---
-			//?
-			//? Find the minimum limit of the specified axes by searching for the limit switch.
-			//?
-			if ((next_target.seen & (1<<L_X)) != 0)
-				home_x_negative();
-			if ((next_target.seen & (1<<L_Y)) != 0)
-				home_y_negative();
-			if ((next_target.seen & (1<<L_Z)) != 0)
-				home_z_negative();
-			break;
-
-		case 162:
-			//? --- G162: Home positive ---
-			//?
-			//? Find the maximum limit of the specified axes by searching for the limit switch.
-			//?
-			if ((next_target.seen & (1<<L_X)) != 0)
-				home_x_positive();
-			if ((next_target.seen & (1<<L_Y)) != 0)
-				home_y_positive();
-			if ((next_target.seen & (1<<L_Z)) != 0)
-				home_z_positive();
-			break;
 	}
 
 	case 'M'
 
-			case 114:
-				//? --- M114: Get Current Position ---
-				//?
-				//? Example: M114
-				//?
-				//? This causes the RepRap machine to report its current X, Y, Z and E coordinates to the host.
-				//?
-				//? For example, the machine returns a string such as:
-				//?
-				//? <tt>ok C: X:0.00 Y:0.00 Z:0.00 E:0.00</tt>
-				//?
-				#ifdef ENFORCE_ORDER
-					// wait for all moves to complete
-					queue_wait();
-				#endif
-				update_current_position(dda);
-				sersendf_P(PSTR("X:%lq,Y:%lq,Z:%lq,E:%lq,F:%ld"), current_position.parameters[L_X], current_position.parameters[L_Y], current_position.parameters[L_Z], current_position.parameters[L_E], current_position.parameters[L_F]);
-				// newline is sent from gcode_parse after we return
-				break;
-			case 250:
-				//? --- M250: return current position, end position, queue ---
-				//? Undocumented
-				//? This command is only available in DEBUG builds.
-				update_current_position(dda);
-				sersendf_P(PSTR("{X:%ld,Y:%ld,Z:%ld,E:%ld,F:%lu,c:%lu}\t{X:%ld,Y:%ld,Z:%ld,E:%ld,F:%lu,c:%lu}\t"), current_position.parameters[L_X], current_position.parameters[L_Y], current_position.parameters[L_Z], current_position.parameters[L_E], current_position.parameters[L_F], movebuffer[mb_tail].c, movebuffer[mb_tail].endpoint.parameters[L_X], movebuffer[mb_tail].endpoint.parameters[L_Y], movebuffer[mb_tail].endpoint.parameters[L_Z], movebuffer[mb_tail].endpoint.parameters[L_E], movebuffer[mb_tail].endpoint.parameters[L_F],
-					#ifdef ACCELERATION_REPRAP
-						movebuffer[mb_tail].end_c
-					#else
-						movebuffer[mb_tail].c
-					#endif
-					);
-
-				print_queue();
-				break;
-
 			// M84- stop idle hold
 			case 84:
 				stepper_disable();
@@ -5,18 +5,38 @@ typedef struct axis_t         axis_t;
 
 typedef void (*func_axis_init)(axis_t *axis);
 typedef void (*func_axis_gcode)(axis_t *axis, void *next_target);
+typedef void (*func_axis_wait)(axis_t *axis, dda_wait_func wait, uint8_t arg, uint32_t dwell);
+typedef int32_t (*func_axis_position)(axis_t *axis);
+typedef void (*func_axis_set_position)(axis_t *axis);
+typedef uint8_t (*func_axis_home)(axis_t *axis, uint8_t max, axis_t *endstop, uint8_t reverse);
+typedef void (*func_axis_stop)(axis_t *axis);
+typedef uint8_t (*func_axis_probe)(axis_t *axis, int32_t target);
+typedef uint8_t (*func_axis_prepare)(axis_t *axis, dda_t *move, int32_t distance, uint32_t feedrate);
+typedef void (*func_axis_enqueue)(axis_t *axis, const dda_t *move);
 
 typedef struct axis_runtime_t {
 	uint8_t                relative :1;          ///< Use relative mode
 	uint8_t                inches   :1;          ///< Use inches (1) or mm (0)
 	void                  *userdata;             ///< Stepper runtime userdata
+	uint16_t               flow;                 ///< Distance actually moved in percent of the requested one, M221
+	const uint32_t        *advance;              ///< Pressure advance of the current tool (us), 0 - none. See M900
+	const int32_t         *offset;               ///< Offset of the current tool added to absolute coordinates (um), 0 - none. See M218
 
-	 int32_t               position_curr;        ///< Current position on axis
+	 int32_t               position_curr;        ///< Current position on axis, end of the last queued move (um)
+	 int32_t               position_motor;       ///< Position of the motor at the end of the last queued move (um), see axes_kinematics_t
 } axis_runtime_t;
 
 typedef struct axis_proto_t {
 	func_axis_init         func_init;            ///< Function to call on start
 	func_axis_gcode        func_gcode;           ///< Function to handle gcodes
+	func_axis_wait         func_wait;            ///< Function to queue a wait token or dwell, 0 - axis doesn't queue
+	func_axis_position     func_position;        ///< Function returning where the axis actually is (um), 0 - unknown
+	func_axis_set_position func_set_position;    ///< Function to take over position_curr while idle, 0 - nothing to update
+	func_axis_home         func_home;            ///< Function to queue homing until the min (0) or max (1) endstop of axis endstop triggers, moving away from it with reverse. Returns 0 without that endstop. 0 - can't home
+	func_axis_stop         func_stop;            ///< Function to stop at once, drop the queue and disable the driver. Called with interrupts disabled
+	func_axis_probe        func_probe;           ///< Function to queue a move to target (um) ending early at the endstop in its direction, returns 0 without that endstop. 0 - can't probe
+	func_axis_prepare      func_prepare;         ///< Function to precalculate a relative move by distance (um) at feedrate (mm/min) for func_enqueue, returns 0 for a null move. 0 - can't
+	func_axis_enqueue      func_enqueue;         ///< Function to queue a move precalculated by func_prepare, positions stay as they are
 } axis_proto_t;
 
 typedef struct axis_t {
@@ -25,16 +45,33 @@ typedef struct axis_t {
 	uint8_t                have_position_max :1; ///< Do we have minimal position value?
 	
 	uint8_t                letter;               ///< Letter for this axis (L_X, L_Y, L_Z, ...)
+	
+	// feedrate_search up to backlash are saved by M500, keep them together
 	uint32_t               feedrate_search;      ///< Search feedrate for this axis (mm/min)
 	uint32_t               feedrate_max;         ///< Maximum feedrate value for this axis (mm/min)
 	 int32_t               position_min;         ///< Minimal position value (um)
 	 int32_t               position_max;         ///< Maximal position value (um)
+	uint32_t               steps_per_m;          ///< Steps per meter, may be changed at runtime
+	uint32_t               backlash;             ///< Play taken up when the axis reverses (um), 0 - none. See M425
 	const void            *userdata;             ///< Stepper userdata
 	
 	axis_proto_t          *proto;                ///< Prototype functions
 	axis_runtime_t         runtime;              ///< Runtime data
 } axis_t;
 
+/** \brief how coordinates map to motors
+
+	Without kinematics each axis drives the motor of its letter, position_motor is position_curr.
+	With kinematics the axis entries for X, Y and Z are motors of the machine, e.g. the towers of a
+	delta, and move() calculates their positions for a target in machine coordinates.
+*/
+typedef struct axes_kinematics_t {
+	uint8_t              (*move)(void *next_target);          ///< queue motor moves with axes_queue_motors(), returns 0 if target can't be reached
+	uint8_t              (*home)(axis_t *axis, uint8_t max);  ///< queue homing of a coordinate to its min (0) or max (1) endstop, returns 0 without that endstop
+	void                 (*homed)(axis_t *axis, uint8_t max); ///< homing of a coordinate is done, set position_curr and position_motor of all axes it moved
+	uint8_t              (*position)(int32_t *xyz);           ///< where X, Y and Z actually are, from func_position() of the motors (um). Returns 0 if a motor can't tell
+} axes_kinematics_t;
+
 extern       axis_t          axes[];
 extern const uint8_t         axes_count;
 #endif
@@ -1,38 +1,62 @@
 #define FEATURE
 #include "common.h"
 #include "axes.h"
+#include "dda_maths.h"
 
 #define IDLE_TIME      100 MS
 #define MIN_STEP_TIME    1 // US
+#define HOMING_BACKOFF 2000 // um, distance to back off from the endstop before probing it again slowly
+#define HOMING_SLOW       4 // reprobe at feedrate_search divided by this
+#define DISABLE_TIMEOUT  30 // s, drivers stay enabled this long with an empty queue, to hold position between moves
+#define ENDSTOP_SAMPLE_TIME 250 // US, between the reads of an endstop which looks triggered, see ENDSTOP_STEPS
 
-API typedef struct axis_stepdir_userdata         { uint8_t pin_step; uint8_t pin_dir; uint8_t pin_enable; uint8_t pin_enable_inv :1; dda_queue_t queue; uint8_t timer_id; } axis_stepdir_userdata;
+API typedef struct axis_stepdir_userdata         { uint8_t pin_step; uint8_t pin_dir; uint8_t pin_enable; uint8_t pin_enable_inv :1; uint8_t pin_min; uint8_t pin_max; uint8_t pin_endstop_inv :1; dda_queue_t queue; uint8_t timer_id; uint8_t endstop_pin; uint8_t endstop_inv :1; uint8_t endstop_count; uint8_t seek_pin; uint8_t seek_inv :1; volatile uint8_t enabled; uint16_t idle_count; } axis_stepdir_userdata;
 
 API void           axis_stepdir_init(axis_t *axis);
 API void           axis_stepdir_gcode(axis_t *axis, void *next_target);
+API void           axis_stepdir_wait(axis_t *axis, dda_wait_func wait, uint8_t arg, uint32_t dwell);
+API int32_t        axis_stepdir_position(axis_t *axis);
+API void           axis_stepdir_set_position(axis_t *axis);
+API uint8_t        axis_stepdir_home(axis_t *axis, uint8_t max, axis_t *endstop, uint8_t reverse);
+API void           axis_stepdir_stop(axis_t *axis);
+API uint8_t        axis_stepdir_probe(axis_t *axis, int32_t target);
+API uint8_t        axis_stepdir_prepare(axis_t *axis, dda_t *move, int32_t distance, uint32_t feedrate);
+API void           axis_stepdir_enqueue(axis_t *axis, const dda_t *move);
 API axis_proto_t   axis_stepdir_proto;
 
+/// switch the driver on or off, the pin is written only when the state changes.
+/// enabled is a byte of its own, not a bit next to seek_inv: the step interrupt writes it, and
+/// a read-modify-write of the shared byte from axis_stepdir_home() could undo that
 void axis_stepdir_enable(axis_t *axis, uint8_t enable){
 	axis_stepdir_userdata *userdata          = (axis_stepdir_userdata *)axis->userdata;
 	
-	if(!userdata->pin_enable)
+	enable = enable ? 1 : 0;
+	
+	if(!userdata->pin_enable || userdata->enabled == enable)
 		return;
 	
-	enable ^= userdata->pin_enable_inv;
+	userdata->enabled = enable;
 	
-	digitalWrite(userdata->pin_enable, enable);
+	digitalWrite(userdata->pin_enable, enable ^ userdata->pin_enable_inv);
 }
 
 void axis_stepdir_step(axis_t *axis, dda_order_t *order){
+	uint8_t                i;
 	axis_stepdir_userdata *userdata          = (axis_stepdir_userdata *)axis->userdata;
 	
-	axis_stepdir_enable(axis, 1);
-	
 	digitalWrite(userdata->pin_dir, order->direction);
-	digitalWrite(userdata->pin_step, HIGH);
-	
-	delayMicroseconds(MIN_STEP_TIME);
 	
-	digitalWrite(userdata->pin_step, LOW);
+	// more than one step at high step rates, see MULTISTEP_RATE
+	for(i = order->steps; i; i--){
+		digitalWrite(userdata->pin_step, HIGH);
+		
+		delayMicroseconds(MIN_STEP_TIME);
+		
+		digitalWrite(userdata->pin_step, LOW);
+		
+		if(i > 1)
+			delayMicroseconds(MIN_STEP_TIME); // drivers need a minimum low time, too
+	}
 }
 
 void axis_stepdir_timer(uint8_t id, void *paxis){
@@ -40,24 +64,53 @@ void axis_stepdir_timer(uint8_t id, void *paxis){
 	axis_t                *axis              = (axis_t *)paxis;
 	axis_stepdir_userdata *userdata          = (axis_stepdir_userdata *)axis->userdata;
 	
+	// 0. homing? Once the endstop reads triggered, hold the next step and read it again every
+	// ENDSTOP_SAMPLE_TIME. ENDSTOP_STEPS triggered reads in a row end the move before that step,
+	// a clear one was noise and the step goes on a little late
+	if(userdata->endstop_pin){
+		if((digitalRead(userdata->endstop_pin) ? 1 : 0) ^ userdata->endstop_inv){
+			if(++userdata->endstop_count < ENDSTOP_STEPS){
+				timer_charge(id, ENDSTOP_SAMPLE_TIME US);
+				return;
+			}
+			dda_queue_stop(&userdata->queue);
+		}
+		userdata->endstop_count = 0;
+	}
+	
 	// 1. make dda step to calculate our next move
 	do{
 		dda_queue_step(&userdata->queue, &order);
 	}while( order.callme == 1 && order.c == 0 ); // if dda request callback immediatly - do it
 	
+	// the endstop to look at before the next step, if any
+	if(!order.step || !order.endstop){
+		userdata->endstop_pin   = 0;
+	}else if(userdata->seek_pin){
+		// homing on the endstop of another axis, see axis_stepdir_home()
+		userdata->endstop_pin   = userdata->seek_pin;
+		userdata->endstop_inv   = userdata->seek_inv;
+	}else{
+		userdata->endstop_pin   = order.direction ? userdata->pin_max : userdata->pin_min;
+		userdata->endstop_inv   = userdata->pin_endstop_inv;
+	}
+	
 	// 2. check dda orders:
 	// - dda ask to step?
-	if(order.step)
+	if(order.step){
+		axis_stepdir_enable(axis, 1);
 		axis_stepdir_step(axis, &order);
-	
-	if(order.done)
-		axis_stepdir_enable(axis, 0); // disable stepper
+	}
 	
 	// - dda ask to callback?
 	if(order.callme){
+		userdata->idle_count = 0;
 		timer_charge(id, order.c);
 	}else{
-		timer_charge(id, IDLE_TIME); // nothing to do, idle mode
+		// nothing to do, idle mode. Keep holding position for a while, the next move may be on its way
+		if(userdata->enabled && ++userdata->idle_count >= DISABLE_TIMEOUT * ((1000 MS) / (IDLE_TIME)))
+			axis_stepdir_enable(axis, 0);
+		timer_charge(id, IDLE_TIME);
 	}
 }
 
@@ -66,32 +119,73 @@ void axis_stepdir_init(axis_t *axis){
 	
 	// init dda queue
 	dda_queue_init(&userdata->queue);
+	dda_queue_set_steps(&userdata->queue, axis->steps_per_m);
 	
-	// init timer
+	// init timer. Without one the axis never steps and its queue fills up for good, better not run at all
 	userdata->timer_id = timer_new();
-	timer_setup  (userdata->timer_id, &axis_stepdir_timer, axis);
-	timer_charge (userdata->timer_id, IDLE_TIME);
+	if(userdata->timer_id == 255){
+		sersendf_P(PSTR("!! axis %c: no timer left\n"), gcode_convert_letter(axis->letter));
+		core_emergency_stop();
+	}else{
+		timer_setup  (userdata->timer_id, &axis_stepdir_timer, axis);
+		timer_charge (userdata->timer_id, IDLE_TIME);
+	}
 	
 	// init outputs
 	pinMode(userdata->pin_dir,    OUTPUT);
 	pinMode(userdata->pin_step,   OUTPUT);
 	digitalWrite(userdata->pin_dir,  LOW);
 	digitalWrite(userdata->pin_step, LOW);
+	userdata->idle_count = 0;
+	userdata->enabled    = 0;
 	if(userdata->pin_enable){
 		pinMode(userdata->pin_enable, OUTPUT);
+		userdata->enabled = 1;                       // state unknown, make sure the pin gets written
 		axis_stepdir_enable(axis, 0);
 	}
+	
+	// endstops, with pullups
+	userdata->endstop_pin   = 0;
+	userdata->endstop_count = 0;
+	userdata->seek_pin    = 0;
+	if(userdata->pin_min){
+		pinMode(userdata->pin_min, INPUT);
+		digitalWrite(userdata->pin_min, HIGH);
+	}
+	if(userdata->pin_max){
+		pinMode(userdata->pin_max, INPUT);
+		digitalWrite(userdata->pin_max, HIGH);
+	}
+}
+
+/// steps per meter or backlash changed by M92, M221, M425, M501 or M502? Redo the conversion constants
+static void axis_stepdir_sync(axis_t *axis){
+	axis_stepdir_userdata *userdata          = (axis_stepdir_userdata *)axis->userdata;
+	uint32_t               steps_per_m       = axis_steps_per_m(axis);
+	
+	if(userdata->queue.steps_per_m != steps_per_m)
+		dda_queue_set_steps(&userdata->queue, steps_per_m);
+	if(userdata->queue.backlash_um != axis->backlash)
+		dda_queue_set_backlash(&userdata->queue, axis->backlash);
 }
 
 void axis_stepdir_gcode(axis_t *axis, void *next_target){
 	dda_target_t           start;
 	dda_target_t           target;
+	uint32_t               advance;
 	axis_stepdir_userdata *userdata          = (axis_stepdir_userdata *)axis->userdata;
 	
+	axis_stepdir_sync(axis);
+	
+	// pressure advance changed by M900 or a tool change?
+	advance = axis->runtime.advance ? *axis->runtime.advance * (F_CPU / 1000000UL) : 0;
+	if(userdata->queue.move.advance != advance)
+		dda_queue_set_advance(&userdata->queue, advance);
+	
 	if(PARAMETER_SEEN(L_G)){
 		switch(PARAMETER_asint(L_G)){
 			case 0:	
-				start.X  = axis->runtime.position_curr;
+				start.X  = axis->runtime.position_motor;
 				start.F  = 0;                                // we start new gcode, so we assume that axis was stopped
 				                                             // if dda look-ahead need feedrate for some move - it will use values from queue
 				target.X = PARAMETER_asint(axis->letter);
@@ -99,26 +193,182 @@ void axis_stepdir_gcode(axis_t *axis, void *next_target){
 				
 				dda_queue_enqueue(&userdata->queue, &start, &target);
 				
-				axis->runtime.position_curr = target.X;
+				axis->runtime.position_motor = target.X;
 				break;
 			case 1:	
-				start.X  = axis->runtime.position_curr;
+				start.X  = axis->runtime.position_motor;
 				start.F  = 0;
 				target.X = PARAMETER_asint(axis->letter);
 				target.F = PARAMETER_asint(L_F);
 				
 				dda_queue_enqueue(&userdata->queue, &start, &target);
 				
-				axis->runtime.position_curr = target.X;
+				axis->runtime.position_motor = target.X;
 				break;
 			// TODO position_min/max
 		}
 	}
 }
 
+void axis_stepdir_wait(axis_t *axis, dda_wait_func wait, uint8_t arg, uint32_t dwell){
+	axis_stepdir_userdata *userdata          = (axis_stepdir_userdata *)axis->userdata;
+	
+	dda_queue_enqueue_wait(&userdata->queue, wait, arg, dwell);
+}
+
+/// position in um from the steps actually done, doesn't wait for the queue. Converted with
+/// steps_per_m without the flow override, which only scales moves, so M221 doesn't move it
+int32_t axis_stepdir_position(axis_t *axis){
+	axis_stepdir_userdata *userdata          = (axis_stepdir_userdata *)axis->userdata;
+	uint32_t               steps_per_m       = axis->steps_per_m;
+	
+	if(!steps_per_m)
+		return 0;
+	
+	return muldivQR(dda_queue_position(&userdata->queue), 1000000UL / steps_per_m, 1000000UL % steps_per_m, steps_per_m);
+}
+
+/// the queue is empty, make the step counter match position_motor
+void axis_stepdir_set_position(axis_t *axis){
+	axis_stepdir_userdata *userdata          = (axis_stepdir_userdata *)axis->userdata;
+	
+	dda_queue_set_position(&userdata->queue, muldiv(axis->runtime.position_motor, axis->steps_per_m, 1000000UL));
+}
+
+/** \brief queue a homing sequence
+	\param max 1 - home to the max endstop, 0 - to the min endstop
+	\param endstop axis the endstop belongs to, axis itself unless the kinematics moves several motors to home
+	\param reverse 1 - the motor runs towards its min while the endstop is approached, e.g. CoreXY
+	\return 0 if there is no such endstop
+
+	Runs into the endstop at feedrate_max, backs off HOMING_BACKOFF and probes again at
+	feedrate_search / HOMING_SLOW. Range and feedrates are those of endstop, so all motors homing
+	on the same endstop move alike. Moves are relative, the caller sets the position once the
+	queue is done.
+*/
+uint8_t axis_stepdir_home(axis_t *axis, uint8_t max, axis_t *endstop, uint8_t reverse){
+	dda_target_t           start;
+	dda_target_t           target;
+	int32_t                range             = endstop->position_max - endstop->position_min;
+	axis_stepdir_userdata *userdata          = (axis_stepdir_userdata *)axis->userdata;
+	axis_stepdir_userdata *switches          = (axis_stepdir_userdata *)endstop->userdata;
+	uint8_t                pin;
+	
+	if(endstop->proto != &axis_stepdir_proto)
+		return 0;
+	
+	pin = max ? switches->pin_max : switches->pin_min;
+	if(!pin)
+		return 0;
+	
+	// only endstop moves look at it, and callers wait for homing and probing to finish
+	userdata->seek_pin = pin;
+	userdata->seek_inv = switches->pin_endstop_inv;
+	max ^= reverse;
+	
+	axis_stepdir_sync(axis);
+	
+	// far enough to reach the endstop from anywhere, even if position is off
+	range   += range / 4 + HOMING_BACKOFF;
+	start.X  = 0;
+	start.F  = 0;
+	
+	target.X = max ? range : -range;
+	target.F = endstop->feedrate_max;
+	dda_queue_enqueue_endstop(&userdata->queue, &start, &target);
+	
+	target.X = max ? -HOMING_BACKOFF : HOMING_BACKOFF;
+	target.F = endstop->feedrate_search;
+	dda_queue_enqueue(&userdata->queue, &start, &target);
+	
+	target.X = max ? 2 * HOMING_BACKOFF : -2 * HOMING_BACKOFF;
+	target.F = endstop->feedrate_search / HOMING_SLOW;
+	dda_queue_enqueue_endstop(&userdata->queue, &start, &target);
+	
+	return 1;
+}
+
+/** \brief queue a probing move
+	\param target where to stop at the latest (um)
+	\return 0 if there is no endstop in that direction
+
+	Moves at feedrate_search. Once the queue is done, func_position tells where the endstop
+	triggered, position_curr and position_motor are left at target.
+*/
+uint8_t axis_stepdir_probe(axis_t *axis, int32_t target){
+	dda_target_t           start;
+	dda_target_t           end;
+	axis_stepdir_userdata *userdata          = (axis_stepdir_userdata *)axis->userdata;
+	
+	if(!(target >= axis->runtime.position_motor ? userdata->pin_max : userdata->pin_min))
+		return 0;
+	
+	axis_stepdir_sync(axis);
+	
+	userdata->seek_pin = 0;
+	start.X = axis->runtime.position_motor;
+	start.F = 0;
+	end.X   = target;
+	end.F   = axis->feedrate_search;
+	dda_queue_enqueue_endstop(&userdata->queue, &start, &end);
+	
+	axis->runtime.position_curr  = target;
+	axis->runtime.position_motor = target;
+	return 1;
+}
+
+/** \brief precalculate a move for axis_stepdir_enqueue()
+	\param distance relative move (um)
+	\param feedrate mm/min
+	\return 0 for a null move
+
+	Uses the steps per meter set now, prepare again after they changed, see axis_steps_per_m().
+*/
+uint8_t axis_stepdir_prepare(axis_t *axis, dda_t *move, int32_t distance, uint32_t feedrate){
+	dda_target_t           start;
+	dda_target_t           target;
+	axis_stepdir_userdata *userdata          = (axis_stepdir_userdata *)axis->userdata;
+	
+	axis_stepdir_sync(axis);
+	
+	start.X  = 0;
+	start.F  = 0;
+	target.X = distance;
+	target.F = feedrate;
+	return dda_queue_prepare(&userdata->queue, move, &start, &target) == 0;
+}
+
+/// queue a move from axis_stepdir_prepare(), position_curr and position_motor stay as they are
+void axis_stepdir_enqueue(axis_t *axis, const dda_t *move){
+	axis_stepdir_userdata *userdata          = (axis_stepdir_userdata *)axis->userdata;
+	
+	dda_queue_enqueue_dda(&userdata->queue, move);
+}
+
+/// emergency stop: no more steps, queue gone, driver off
+void axis_stepdir_stop(axis_t *axis){
+	axis_stepdir_userdata *userdata          = (axis_stepdir_userdata *)axis->userdata;
+	
+	if(userdata->timer_id != 255)
+		timer_disable(userdata->timer_id);
+	dda_queue_flush(&userdata->queue);
+	userdata->endstop_pin   = 0;
+	userdata->endstop_count = 0;
+	
+	digitalWrite(userdata->pin_step, LOW);
+	axis_stepdir_enable(axis, 0);
+}
 
 axis_proto_t  axis_stepdir_proto = {
-	.func_gcode = &axis_stepdir_gcode,
-	.func_init  = &axis_stepdir_init,
+	.func_gcode        = &axis_stepdir_gcode,
+	.func_init         = &axis_stepdir_init,
+	.func_wait         = &axis_stepdir_wait,
+	.func_position     = &axis_stepdir_position,
+	.func_set_position = &axis_stepdir_set_position,
+	.func_home         = &axis_stepdir_home,
+	.func_stop         = &axis_stepdir_stop,
+	.func_probe        = &axis_stepdir_probe,
+	.func_prepare      = &axis_stepdir_prepare,
+	.func_enqueue      = &axis_stepdir_enqueue,
 };
 
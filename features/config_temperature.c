@@ -1,8 +1,21 @@
 #include "common.h"
 
+const heater_t                heaters[] = {
+	//{ 11, &OCR2A, 0 },
+	//{ 12, 0,      (softpwm_config_t []){ { 100 MS, 64, 0 } } },    // 10 Hz software PWM
+	//{  4, 0,      (softpwm_config_t []){ {  10 MS, 32, 25 } } },   // fan, 100 Hz, 250 ms kick-start
+};
+const uint8_t                 heaters_count = (sizeof(heaters) / sizeof(heaters[0]));
+      heater_runtime_t        heaters_runtime[(sizeof(heaters) / sizeof(heaters[0]))];
+      heater_pid_t            heaters_pid    [(sizeof(heaters) / sizeof(heaters[0]))];
+      heater_model_t          heaters_model  [(sizeof(heaters) / sizeof(heaters[0]))];
+
 const temp_sensor_t           temp_sensors[] = {
-	//{ 0, 'T', &max6675_init, &max6675_read, (sensor_max6675_userdata []){ { } } }
-	
+	//{ 0, 'T', 0,              &thermistor_setup, &thermistor_read, (sensor_thermistor_userdata []){ { 0, THERMISTOR_EXTRUDER } } },
+	//{ 1, 'B', 1,              &max6675_setup,    &max6675_read,    (sensor_max6675_userdata []){ { } } },
+	//{ 2, 'C', TEMP_NO_HEATER, &ad595_setup,      &ad595_read,      (sensor_ad595_userdata []){ { 2 } } },
+
 };
 const uint8_t                 temp_sensors_count = (sizeof(temp_sensors) / sizeof(temp_sensors[0]));
       temp_sensor_runtime_t   temp_sensors_runtime[(sizeof(temp_sensors) / sizeof(temp_sensors[0]))];
+      int16_t                 temp_sensors_offset [(sizeof(temp_sensors) / sizeof(temp_sensors[0]))];
@@ -1,6 +1,13 @@
 #define FEATURE
 #include "common.h"
 
+// CONFIGURATION
+
+/// index of the fan in heaters[], see config_temperature.c. Give it a softpwm entry there to modulate it on any pin.
+//#define HEATER_FAN 2
+
+// END OF CONFIGURATION
+
 API void fan_init(void);
 
 void fan_gcode_process(void *next_target){
@@ -12,16 +19,17 @@ void fan_gcode_process(void *next_target){
 		case 106:
 			//? --- M106: Fan On ---
 			//?
-			//? Example: M106
+			//? Example: M106 S127
 			//?
-			//? Turn on the cooling fan (if any).
+			//? Turn on the cooling fan (if any). S sets the speed from 0 to 255, default is full speed.
+			//? Teacup supports an optional P parameter as heater index to address.
 			//?
 			
-			// core_emit(EVENT_IDLE);
-			/* FIXME #ifdef HEATER_FAN
-				heater_set(HEATER_FAN, 255);
+			#ifdef HEATER_FAN
+				heater_set(PARAMETER_SEEN(L_P) ? PARAMETER_asint(L_P) : HEATER_FAN,
+				           PARAMETER_SEEN(L_S) ? PARAMETER_asint(L_S) : 255);
+				power_on();
 			#endif
-			*/
 			break;
 
 		case 9:
@@ -33,11 +41,9 @@ void fan_gcode_process(void *next_target){
 			//? Turn off the cooling fan (if any).
 			//?
 			
-			// core_emit(EVENT_IDLE);
-			/* FIXME #ifdef HEATER_FAN
-				heater_set(HEATER_FAN, 0);
+			#ifdef HEATER_FAN
+				heater_set(PARAMETER_SEEN(L_P) ? PARAMETER_asint(L_P) : HEATER_FAN, 0);
 			#endif
-			*/
 			break;
 	}
 }
@@ -45,4 +51,3 @@ void fan_gcode_process(void *next_target){
 void fan_init(void){
 	core_register(EVENT_GCODE_PROCESS, &fan_gcode_process);
 }
-
@@ -1,12 +1,24 @@
 #include "common.h"
 
+// CONFIGURATION
+
+/// number of relay oscillations M303 averages before computing factors; the first one is discarded
+#define	AUTOTUNE_CYCLES		5
+/// abort M303 if temperature exceeds the setpoint by this many degrees
+#define	AUTOTUNE_OVERSHOOT	20
+/// abort M303 if one half-oscillation takes more than this many samples
+#define	AUTOTUNE_TIMEOUT	30000
+
+/// feed forward the holding power predicted by a first order heater model (see heater_model.h), set it up with M137-M139
+#define	HEATER_MODEL
+
+// END OF CONFIGURATION
+
 #include	<stdlib.h>
-#include	<avr/eeprom.h>
 #include	<avr/pgmspace.h>
 
 #include	"arduino.h"
 #include	"debug.h"
-#include	"crc.h"
 
 /// default scaled P factor, equivalent to 8.0
 #define		DEFAULT_P				8192
@@ -17,75 +29,52 @@
 /// default scaled I limit
 #define		DEFAULT_I_LIMIT	384
 
-/// \struct heater_t
-/// \brief simply holds pinout data- port, pin, pwm channel if used
-typedef struct heater_t {
-	volatile uint8_t      *heater_port; ///< pointer to port. DDR is inferred from this pointer too
-	uint8_t	               heater_pin;  ///< heater pin, not masked. eg for PB3 enter '3' here, or PB3_PIN or similar
-	volatile uint8_t      *heater_pwm;  ///< pointer to 8-bit PWM register, eg OCR0A (8-bit) or ORC3L (low byte, 16-bit)
-} heater_t;
-
-/**
-	\struct heater_pid_t
-	\brief this struct holds the heater PID factors
-
-	PID is a fascinating way to control any closed loop control, combining the error (P), cumulative error (I) and rate at which we're approacing the setpoint (D) in such a way that when correctly tuned, the system will achieve target temperature quickly and with little to no overshoot
-
-	At every sample, we calculate \f$OUT = k_P (S - T) + k_I \int (S - T) + k_D \frac{dT}{dt}\f$ where S is setpoint and T is temperature.
-
-	The three factors kP, kI, kD are chosen to give the desired behaviour given the dynamics of the system.
-
-	See http://www.eetimes.com/design/embedded/4211211/PID-without-a-PhD for the full story
-*/
-typedef struct heater_pid_t {
-	int32_t						p_factor; ///< scaled P factor
-	int32_t						i_factor; ///< scaled I factor
-	int32_t						d_factor; ///< scaled D factor
-	int16_t						i_limit;  ///< scaled I limit, such that \f$-i_{limit} < i_{factor} < i_{limit}\f$
-	uint16_t                                        crc;      ///< crc so we can use defaults if eeprom data is invalid
-} heater_pid_t;
-const uint8_t            heater_pid_EE_size = sizeof(heater_pid_t) - sizeof(uint16_t); // size of structure - sizeof(crc);
-
-/// \brief this struct holds the runtime heater data- PID integrator history, temperature history, sanity checker
-typedef struct heater_runtime_t {
-	int16_t						heater_i; ///< integrator, \f$-i_{limit} < \sum{\Delta t} < i_{limit}\f$
-
-	uint16_t					temp_history[TH_COUNT]; ///< store last TH_COUNT readings in a ring, so we can smooth out our differentiator
-	uint8_t						temp_history_pointer;   ///< pointer to last entry in ring
-
-	#ifdef	HEATER_SANITY_CHECK
-		uint16_t					sanity_counter;				///< how long things haven't seemed sane
-		uint16_t					sane_temperature;			///< a temperature we consider sane given the heater settings
-	#endif
-
-	uint8_t						heater_output;					///< this is the PID value we eventually send to the heater
-} heater_runtime_t;
-
-#undef DEFINE_HEATER
-#define        DEFINE_HEATER(name, pin) { &(pin ## _WPORT), pin ## _PIN, (pin ## _PWM) },
-const heater_t           heaters[] = {
-/* FIXME	DEFINE_HEATER(bed, PB3)
-	DEFINE_HEATER(bed, PB4)*/
-};
-#define NUM_HEATERS     (sizeof(heaters) / sizeof(heaters[0])) 
-const uint8_t            heaters_count  = NUM_HEATERS;
-      heater_pid_t       heaters_pid     [NUM_HEATERS];
-      heater_pid_t EEMEM heaters_pid_EE  [NUM_HEATERS];
-      heater_runtime_t   heaters_runtime [NUM_HEATERS];
-
 
 #define	enable_heater()		heater_set(0, 64)
 #define	disable_heater()	heater_set(0, 0)
 
 API void heater_init(void);
+API void heater_tick(uint8_t id, uint16_t current_temp, uint16_t target_temp);
+API void heater_set(uint8_t id, uint8_t value);
+
+void heater_print(uint16_t i);
+void heater_gcode_process(void *next_target);
 
 /** \file
 	\brief Manage heaters
 */
 
 
+#ifndef BANG_BANG
+/// \brief set PID factors of all heaters to compiled in defaults
+void heater_pid_defaults(void) {
+	uint8_t i;
+
+	for (i = 0; i < heaters_count; i++) {
+		heaters_pid[i].p_factor = DEFAULT_P;
+		heaters_pid[i].i_factor = DEFAULT_I;
+		heaters_pid[i].d_factor = DEFAULT_D;
+		heaters_pid[i].i_limit  = DEFAULT_I_LIMIT;
+	}
+}
+#endif /* BANG_BANG */
+
+/// emergency stop, heaters off without going through heater_set(), which may print
+static void heater_emergency_stop(void *data) {
+	uint8_t i;
+
+	for (i = 0; i < heaters_count; i++) {
+		heaters_runtime[i].heater_output = 0;
+		if (heaters[i].pwm)
+			*heaters[i].pwm = 0;
+		else if (heaters_runtime[i].softpwm == 255)
+			digitalWrite(heaters[i].pin, LOW);
+		// softpwm channels are switched off by softpwm itself
+	}
+}
+
 /// \brief initialise heater subsystem
-/// Set directions, initialise PWM timers, read PID factors from eeprom, etc
+/// Set directions, initialise PWM timers, register PID factors with settings, etc
 void heater_init() {
 	// setup PWM timers: fast PWM, no prescaler
 	TCCR0A = MASK(WGM01) | MASK(WGM00);
@@ -140,21 +129,21 @@ void heater_init() {
 		OCR5B = 0;
 	#endif
 	
-	// set all heater pins to output
-	do {
-		#undef	DEFINE_HEATER
-		#define	DEFINE_HEATER(name, pin) WRITE(pin, 0); SET_OUTPUT(pin);
-			#include "common.h"
-		#undef DEFINE_HEATER
-	} while (0);
-	
 	uint8_t i;
 	// setup pins
-	for (i = 0; i < NUM_HEATERS; i++) {
-		if (heaters[i].heater_pwm) {
-			*heaters[i].heater_pwm = 0;
+	for (i = 0; i < heaters_count; i++) {
+		// set all heater pins to output
+		digitalWrite(heaters[i].pin, LOW);
+		pinMode(heaters[i].pin, OUTPUT);
+
+		heaters_runtime[i].softpwm = 255;
+		if (heaters[i].pwm == 0 && heaters[i].softpwm)
+			heaters_runtime[i].softpwm = softpwm_new(heaters[i].pin, heaters[i].softpwm);
+
+		if (heaters[i].pwm) {
+			*heaters[i].pwm = 0;
 			// this is somewhat ugly too, but switch() won't accept pointers for reasons unknown
-			switch((uint16_t) heaters[i].heater_pwm) {
+			switch((uint16_t) heaters[i].pwm) {
 				case (uint16_t) &OCR0A:
 					TCCR0A |= MASK(COM0A1);
 					break;
@@ -209,23 +198,20 @@ void heater_init() {
 			// 0 is a "sane" temperature when we're trying to cool down
 			heaters_runtime[i].sane_temperature = 0;
 		#endif
-
-		#ifndef BANG_BANG
-			// read factors from eeprom
-			heaters_pid[i].p_factor = eeprom_read_dword((uint32_t *) &heaters_pid_EE[i].p_factor);
-			heaters_pid[i].i_factor = eeprom_read_dword((uint32_t *) &heaters_pid_EE[i].i_factor);
-			heaters_pid[i].d_factor = eeprom_read_dword((uint32_t *) &heaters_pid_EE[i].d_factor);
-			heaters_pid[i].i_limit  = eeprom_read_word ((uint16_t *) &heaters_pid_EE[i].i_limit);
-
-// 			if ((heaters_pid[i].p_factor == 0) && (heaters_pid[i].i_factor == 0) && (heaters_pid[i].d_factor == 0) && (heaters_pid[i].i_limit == 0)) {
-			if (crc_block(&heaters_pid[i].p_factor, heater_pid_EE_size) != eeprom_read_word((uint16_t *) &heaters_pid_EE[i].crc)) {
-				heaters_pid[i].p_factor = DEFAULT_P;
-				heaters_pid[i].i_factor = DEFAULT_I;
-				heaters_pid[i].d_factor = DEFAULT_D;
-				heaters_pid[i].i_limit  = DEFAULT_I_LIMIT;
-			}
-		#endif /* BANG_BANG */
 	}
+
+	// saved factors and models replace these in settings_init()
+	#ifndef BANG_BANG
+		heater_pid_defaults();
+		settings_register(heaters_pid, sizeof(heater_pid_t) * heaters_count, &heater_pid_defaults);
+	#endif /* BANG_BANG */
+	#ifdef	HEATER_MODEL
+		// no model means plain PID
+		settings_register(heaters_model, sizeof(heater_model_t) * heaters_count, 0);
+	#endif /* HEATER_MODEL */
+
+	core_register(EVENT_GCODE_PROCESS,  &heater_gcode_process);
+	core_register(EVENT_EMERGENCY_STOP, &heater_emergency_stop);
 }
 
 /** \brief manually set PWM output
@@ -235,58 +221,211 @@ void heater_init() {
 	anything done by this function is overwritten by heater_tick above if the heater has an associated temp sensor
 */
 void heater_set(uint8_t id, uint8_t value) {
-	if (id >= NUM_HEATERS)
+	if (id >= heaters_count)
 		return;
 
+	if (core_stopped)
+		value = 0;
+
 	heaters_runtime[id].heater_output = value;
 
-	if (heaters[id].heater_pwm) {
-		*(heaters[id].heater_pwm) = value;
+	if (heaters[id].pwm) {
+		*(heaters[id].pwm) = value;
 		#ifdef	DEBUG
 		if (DEBUG_PID && (debug_flags & DEBUG_PID))
-			sersendf_P(PSTR("PWM{%u = %u}\n"), id, OCR0A);
+			sersendf_P(PSTR("PWM{%u = %u}\n"), id, value);
 		#endif
 	}
+	else if (heaters_runtime[id].softpwm != 255) {
+		softpwm_set(heaters_runtime[id].softpwm, value);
+	}
 	else {
-		if (value >= 8)
-			*(heaters[id].heater_port) |= MASK(heaters[id].heater_pin);
-		else
-			*(heaters[id].heater_port) &= ~MASK(heaters[id].heater_pin);
+		digitalWrite(heaters[id].pin, (value >= 8) ? HIGH : LOW);
 	}
 }
 
-/// \brief Write PID factors to eeprom
-void heater_save_settings(void) {
-	#ifndef BANG_BANG
-		uint8_t i;
-		for (i = 0; i < NUM_HEATERS; i++) {
-			eeprom_write_dword((uint32_t *) &heaters_pid_EE[i].p_factor, heaters_pid[i].p_factor);
-			eeprom_write_dword((uint32_t *) &heaters_pid_EE[i].i_factor, heaters_pid[i].i_factor);
-			eeprom_write_dword((uint32_t *) &heaters_pid_EE[i].d_factor, heaters_pid[i].d_factor);
-			eeprom_write_word ((uint16_t *) &heaters_pid_EE[i].i_limit,  heaters_pid[i].i_limit);
-			eeprom_write_word ((uint16_t *) &heaters_pid_EE[i].crc,      crc_block(&heaters_pid[i].p_factor, heater_pid_EE_size));
-		}
-	#endif /* BANG_BANG */
+#ifndef	BANG_BANG
+/** \brief relay feedback autotune state
+
+	While M303 runs, the heater is driven as a relay around the setpoint: full bias + d below it,
+	bias - d above it. The resulting limit cycle has amplitude a and period Tu, from which the
+	ultimate gain Ku = 4d / (pi a) follows. Bias is re-centred every cycle so heating and cooling
+	halves become symmetric, which is what the describing function analysis assumes.
+
+	Only one heater can be tuned at a time; heater == 255 means idle.
+*/
+static struct {
+	uint8_t                heater;
+	uint8_t                heating;
+	uint8_t                cycles;
+	uint8_t                bias;
+	uint8_t                d;
+	uint16_t               target;
+	uint16_t               t_min;
+	uint16_t               t_max;
+	uint16_t               samples;         ///< samples since the current half-oscillation started
+	uint16_t               t_high;          ///< length of the last heating half, in samples
+	uint32_t               ku_sum;          ///< sum of scaled Ku over the measured cycles
+	uint32_t               tu_sum;          ///< sum of Tu over the measured cycles, in samples
+} autotune = { 255 };
+
+/** \brief start M303 relay autotune
+	\param id heater to tune
+	\param target setpoint to oscillate around, 14.2 fixed point
+*/
+void heater_autotune_start(uint8_t id, uint16_t target) {
+	if (id >= heaters_count || target == 0)
+		return;
+
+	autotune.heater  = id;
+	autotune.target  = target;
+	autotune.heating = 1;
+	autotune.cycles  = 0;
+	autotune.bias    = 127;
+	autotune.d       = 127;
+	autotune.t_min   = 0xFFFF;
+	autotune.t_max   = 0;
+	autotune.samples = 0;
+	autotune.t_high  = 0;
+	autotune.ku_sum  = 0;
+	autotune.tu_sum  = 0;
+
+	heaters_runtime[id].pid.heater_i = 0;
+	heater_set(id, 255);
+}
+
+/// abandon autotune, leaving the heater off
+static void heater_autotune_abort(PGM_P reason) {
+	heater_set(autotune.heater, 0);
+	autotune.heater = 255;
+	serial_writestr_P(reason);
+}
+
+/** \brief one autotune sample, called from heater_tick instead of the PID loop
+	\param current_temp latest reading of the heater's sensor
+*/
+static void heater_autotune_tick(uint16_t current_temp) {
+	uint8_t                id = autotune.heater;
+
+	if (current_temp > autotune.target + (AUTOTUNE_OVERSHOOT * 4)) {
+		heater_autotune_abort(PSTR("!! autotune: overshoot\n"));
+		return;
+	}
+	if (++autotune.samples > AUTOTUNE_TIMEOUT) {
+		heater_autotune_abort(PSTR("!! autotune: timeout\n"));
+		return;
+	}
+
+	if (current_temp > autotune.t_max)
+		autotune.t_max = current_temp;
+	if (current_temp < autotune.t_min)
+		autotune.t_min = current_temp;
+
+	if (autotune.heating) {
+		if (current_temp <= autotune.target)
+			return;
+
+		// crossed upwards: switch relay to cooling
+		autotune.heating = 0;
+		autotune.t_high  = autotune.samples;
+		autotune.samples = 0;
+		heater_set(id, autotune.bias - autotune.d);
+		return;
+	}
+
+	if (current_temp >= autotune.target)
+		return;
+
+	// crossed downwards: one full oscillation done
+	uint16_t               t_low = autotune.samples;
+	uint16_t               tu    = autotune.t_high + t_low;
+
+	if (autotune.cycles > 0) {
+		// amplitude a = (t_max - t_min) / 2 quarter degrees
+		// Ku = 4d / (pi a) = 8d / (pi (t_max - t_min)), scaled by PID_SCALE, pi ~ 355/113
+		uint16_t             swing = autotune.t_max - autotune.t_min;
+		if (swing == 0)
+			swing = 1;
+		autotune.ku_sum += ((uint32_t) autotune.d * PID_SCALE * 8 * 113) / ((uint32_t) 355 * swing);
+		autotune.tu_sum += tu;
+
+		sersendf_P(PSTR("autotune: bias %u d %u min %u max %u Tu %u\n"), autotune.bias, autotune.d, autotune.t_min >> 2, autotune.t_max >> 2, tu);
+	}
+
+	if (++autotune.cycles > AUTOTUNE_CYCLES) {
+		uint32_t             ku = autotune.ku_sum / AUTOTUNE_CYCLES;
+		uint32_t             tu_avg = autotune.tu_sum / AUTOTUNE_CYCLES;
+		int32_t              p, i, d;
+
+		if (tu_avg == 0)
+			tu_avg = 1;
+
+		// classic Ziegler-Nichols: Kp = 0.6 Ku, Ti = Tu / 2, Td = Tu / 8
+		// I runs once per sample, D spans TH_COUNT - 1 samples of history
+		p = ku * 6 / 10;
+		i = p * 2 / tu_avg;
+		d = p * tu_avg / (8 * (TH_COUNT - 1));
+		if (i == 0)
+			i = 1;
+
+		heaters_pid[id].p_factor = p;
+		heaters_pid[id].i_factor = i;
+		heaters_pid[id].d_factor = d;
+		// let the integrator alone drive the heater to full output, no further
+		heaters_pid[id].i_limit  = ((255 * PID_SCALE) / i > 0x7FFF) ? 0x7FFF : (255 * PID_SCALE) / i;
+		heaters_runtime[id].pid.heater_i = 0;
+
+		settings_save();
+		heater_set(id, 0);
+		autotune.heater = 255;
+
+		sersendf_P(PSTR("autotune: done, heater %u "), id);
+		heater_print(id);
+		serial_writechar('\n');
+		return;
+	}
+
+	// re-centre bias so heating and cooling halves take equally long
+	int16_t                bias = autotune.bias + ((int32_t) autotune.d * ((int16_t) autotune.t_high - (int16_t) t_low)) / (int16_t) tu;
+	if (bias < 20)
+		bias = 20;
+	else if (bias > 235)
+		bias = 235;
+	autotune.bias = bias;
+	autotune.d    = (bias > 127) ? 255 - bias : bias;
+
+	autotune.heating = 1;
+	autotune.samples = 0;
+	autotune.t_min   = 0xFFFF;
+	autotune.t_max   = 0;
+	heater_set(id, autotune.bias + autotune.d);
 }
+#endif /* BANG_BANG */
 
 /** \brief run heater PID algorithm
 	\param id which heater we're running the loop for
-	\param type which temp sensor type this heater is attached to
 	\param current_temp the temperature that the associated temp sensor is reporting
 	\param target_temp the temperature we're trying to achieve
 */
-void heater_tick(uint8_t id /*, temp_type_t type*/, uint16_t current_temp, uint16_t target_temp) {
+void heater_tick(uint8_t id, uint16_t current_temp, uint16_t target_temp) {
 	uint8_t		pid_output;
 
-	#ifndef	BANG_BANG
-		int16_t		heater_p;
-		int16_t		heater_d;
+	#if	defined DEBUG && ! defined BANG_BANG
 		int16_t		t_error = target_temp - current_temp;
-	#endif	/* BANG_BANG */
+		int16_t		heater_i;
+		int16_t		heater_d;
+	#endif
 
-	if (id >= NUM_HEATERS)
+	if (id >= heaters_count)
 		return;
 
+	#ifndef	BANG_BANG
+		if (id == autotune.heater) {
+			heater_autotune_tick(current_temp);
+			return;
+		}
+	#endif	/* BANG_BANG */
+
 	if (target_temp == 0) {
 		heater_set(id, 0);
 		return;
@@ -301,45 +440,19 @@ void heater_tick(uint8_t id /*, temp_type_t type*/, uint16_t current_temp, uint1
 	#endif  TEMP_NONE */
 
 	#ifndef	BANG_BANG
-		heaters_runtime[id].temp_history[heaters_runtime[id].temp_history_pointer++] = current_temp;
-		heaters_runtime[id].temp_history_pointer &= (TH_COUNT - 1);
-
-		// PID stuff
-		// proportional
-		heater_p = t_error;
-
-		// integral
-		heaters_runtime[id].heater_i += t_error;
-		// prevent integrator wind-up
-		if (heaters_runtime[id].heater_i > heaters_pid[id].i_limit)
-			heaters_runtime[id].heater_i = heaters_pid[id].i_limit;
-		else if (heaters_runtime[id].heater_i < -heaters_pid[id].i_limit)
-			heaters_runtime[id].heater_i = -heaters_pid[id].i_limit;
-
-		// derivative
-		// note: D follows temp rather than error so there's no large derivative when the target changes
-		heater_d = heaters_runtime[id].temp_history[heaters_runtime[id].temp_history_pointer] - current_temp;
-
-		// combine factors
-		int32_t pid_output_intermed = (
-			(
-				(((int32_t) heater_p) * heaters_pid[id].p_factor) +
-				(((int32_t) heaters_runtime[id].heater_i) * heaters_pid[id].i_factor) +
-				(((int32_t) heater_d) * heaters_pid[id].d_factor)
-			) / PID_SCALE
-		);
-
-		// rebase and limit factors
-		if (pid_output_intermed > 255)
-			pid_output = 255;
-		else if (pid_output_intermed < 0)
-			pid_output = 0;
-		else
-			pid_output = pid_output_intermed & 0xFF;
+		#ifdef	HEATER_MODEL
+			pid_output = heater_pid_step(&heaters_pid[id], &heaters_runtime[id].pid, &heaters_model[id], current_temp, target_temp);
+		#else
+			pid_output = heater_pid_step(&heaters_pid[id], &heaters_runtime[id].pid, 0, current_temp, target_temp);
+		#endif
 
 		#ifdef	DEBUG
-		if (DEBUG_PID && (debug_flags & DEBUG_PID))
-			sersendf_P(PSTR("T{E:%d, P:%d * %ld = %ld / I:%d * %ld = %ld / D:%d * %ld = %ld # O: %ld = %u}\n"), t_error, heater_p, heaters_pid[id].p_factor, (int32_t) heater_p * heaters_pid[id].p_factor / PID_SCALE, heaters_runtime[id].heater_i, heaters_pid[id].i_factor, (int32_t) heaters_runtime[id].heater_i * heaters_pid[id].i_factor / PID_SCALE, heater_d, heaters_pid[id].d_factor, (int32_t) heater_d * heaters_pid[id].d_factor / PID_SCALE, pid_output_intermed, pid_output);
+		if (DEBUG_PID && (debug_flags & DEBUG_PID)) {
+			heater_i = heaters_runtime[id].pid.heater_i;
+			// the oldest reading is the one heater_pid_step() took the derivative from
+			heater_d = heaters_runtime[id].pid.temp_history[heaters_runtime[id].pid.temp_history_pointer] - current_temp;
+			sersendf_P(PSTR("T{E:%d, P:%d * %ld = %ld / I:%d * %ld = %ld / D:%d * %ld = %ld # O: %u}\n"), t_error, t_error, heaters_pid[id].p_factor, (int32_t) t_error * heaters_pid[id].p_factor / PID_SCALE, heater_i, heaters_pid[id].i_factor, (int32_t) heater_i * heaters_pid[id].i_factor / PID_SCALE, heater_d, heaters_pid[id].d_factor, (int32_t) heater_d * heaters_pid[id].d_factor / PID_SCALE, pid_output);
+		}
 		#endif
 	#else
 		if (current_temp >= target_temp)
@@ -415,7 +528,7 @@ void heater_tick(uint8_t id /*, temp_type_t type*/, uint16_t current_temp, uint1
 // FIXME catch estop
 uint8_t heaters_all_off(void) {
 	uint8_t i;
-	for (i = 0; i < NUM_HEATERS; i++) {
+	for (i = 0; i < heaters_count; i++) {
 		if (heaters_runtime[i].heater_output > 0)
 			return 0;
 	}
@@ -429,7 +542,7 @@ uint8_t heaters_all_off(void) {
 */
 void pid_set_p(uint8_t id, int32_t p) {
 	#ifndef	BANG_BANG
-		if (id >= NUM_HEATERS)
+		if (id >= heaters_count)
 			return;
 
 		heaters_pid[id].p_factor = p;
@@ -442,7 +555,7 @@ void pid_set_p(uint8_t id, int32_t p) {
 */
 void pid_set_i(uint8_t id, int32_t i) {
 	#ifndef	BANG_BANG
-		if (id >= NUM_HEATERS)
+		if (id >= heaters_count)
 			return;
 
 		heaters_pid[id].i_factor = i;
@@ -455,7 +568,7 @@ void pid_set_i(uint8_t id, int32_t i) {
 */
 void pid_set_d(uint8_t id, int32_t d) {
 	#ifndef	BANG_BANG
-		if (id >= NUM_HEATERS)
+		if (id >= heaters_count)
 			return;
 
 		heaters_pid[id].d_factor = d;
@@ -468,7 +581,7 @@ void pid_set_d(uint8_t id, int32_t d) {
 */
 void pid_set_i_limit(uint8_t id, int32_t i_limit) {
 	#ifndef	BANG_BANG
-		if (id >= NUM_HEATERS)
+		if (id >= heaters_count)
 			return;
 
 		heaters_pid[id].i_limit = i_limit;
@@ -480,19 +593,144 @@ void pid_set_i_limit(uint8_t id, int32_t i_limit) {
 	\param i id of heater to send info for
 */
 void heater_print(uint16_t i) {
-	sersendf_P(PSTR("P:%ld I:%ld D:%ld Ilim:%u crc:%u "), heaters_pid[i].p_factor, heaters_pid[i].i_factor, heaters_pid[i].d_factor, heaters_pid[i].i_limit, crc_block(&heaters_pid[i].p_factor, heater_pid_EE_size));
+	sersendf_P(PSTR("P:%ld I:%ld D:%ld Ilim:%u "), heaters_pid[i].p_factor, heaters_pid[i].i_factor, heaters_pid[i].d_factor, heaters_pid[i].i_limit);
+	#ifdef	HEATER_MODEL
+		sersendf_P(PSTR("gain:%u tau:%u amb:%u "), heaters_model[i].gain >> 2, heaters_model[i].tau, heaters_model[i].ambient >> 2);
+	#endif
 }
 #endif
 
-/*
-#if E_STARTSTOP_STEPS > 0
-/// move E by a certain amount at a certain speed
-static void SpecialMoveE(int32_t e, uint32_t f) {
-	TARGET t = { 0L, 0L, 0L, e, f, 1 };
-	enqueue(&t);
+/// handle heater tuning gcodes. P selects the heater index, defaulting to 0
+void heater_gcode_process(void *next_target) {
+	uint8_t                id;
+
+	if(! PARAMETER_SEEN(L_M))
+		return;
+
+	id = PARAMETER_SEEN(L_P) ? PARAMETER_asint(L_P) : 0;
+
+	switch(PARAMETER_asint(L_M)){
+		case 130:
+			//? --- M130: heater P factor ---
+			//?
+			//? Example: M130 P0 S8.0
+			//?
+			//? Set the P factor of heater P. S is unscaled, it's multiplied by PID_SCALE here.
+			//?
+			if (PARAMETER_SEEN(L_S))
+				pid_set_p(id, PARAMETER_asmult(L_S, PID_SCALE));
+			break;
+
+		case 131:
+			//? --- M131: heater I factor ---
+			//?
+			//? Example: M131 P0 S0.5
+			//?
+			if (PARAMETER_SEEN(L_S))
+				pid_set_i(id, PARAMETER_asmult(L_S, PID_SCALE));
+			break;
+
+		case 132:
+			//? --- M132: heater D factor ---
+			//?
+			//? Example: M132 P0 S24
+			//?
+			if (PARAMETER_SEEN(L_S))
+				pid_set_d(id, PARAMETER_asmult(L_S, PID_SCALE));
+			break;
+
+		case 133:
+			//? --- M133: heater I limit ---
+			//?
+			//? Example: M133 P0 S384
+			//?
+			if (PARAMETER_SEEN(L_S))
+				pid_set_i_limit(id, PARAMETER_asint(L_S));
+			break;
+
+		case 134:
+			//? --- M134: save PID settings to eeprom ---
+			//?
+			//? Same as M500, saves all settings.
+			//?
+			settings_save();
+			break;
+
+		case 135:
+			//? --- M135: set heater output ---
+			//?
+			//? Example: M135 P0 S128
+			//?
+			//? Output is overwritten by the control loop if the heater's sensor has a target temperature.
+			//?
+			if (PARAMETER_SEEN(L_S)) {
+				heater_set(id, PARAMETER_asint(L_S));
+				power_on();
+			}
+			break;
+
+		case 136:
+			//? --- M136: print PID settings to host ---
+			//?
+			if (id < heaters_count)
+				heater_print(id);
+			break;
+
+		#ifdef	HEATER_MODEL
+		case 137:
+			//? --- M137: heater model gain ---
+			//?
+			//? Example: M137 P0 S300
+			//?
+			//? Temperature heater P would settle at above ambient if left at full power, in <sup>o</sup>C. S0 disables the model.
+			//?
+			if (PARAMETER_SEEN(L_S) && id < heaters_count)
+				heaters_model[id].gain = PARAMETER_asmult(L_S, 4);
+			break;
+
+		case 138:
+			//? --- M138: heater model time constant ---
+			//?
+			//? Example: M138 P0 S4500
+			//?
+			//? Time heater P takes to cover 63% of a temperature step, in temperature samples.
+			//?
+			if (PARAMETER_SEEN(L_S) && id < heaters_count)
+				heaters_model[id].tau = PARAMETER_asint(L_S);
+			break;
+
+		case 139:
+			//? --- M139: heater model ambient temperature ---
+			//?
+			//? Example: M139 P0 S25
+			//?
+			if (PARAMETER_SEEN(L_S) && id < heaters_count)
+				heaters_model[id].ambient = PARAMETER_asmult(L_S, 4);
+			break;
+		#endif /* HEATER_MODEL */
+
+		#ifndef	BANG_BANG
+		case 303:
+			//? --- M303: PID autotune ---
+			//?
+			//? Example: M303 P0 S200
+			//?
+			//? Oscillate heater P around S<sup>o</sup>C with relay feedback, measure the limit cycle and
+			//? derive P, I and D factors from it (Ziegler-Nichols). Results are reported, applied and saved to eeprom.
+			//? Send M303 without S to abort. The heater's regular target temperature is ignored while tuning.
+			//?
+			if (PARAMETER_SEEN(L_S) && PARAMETER_asint(L_S)) {
+				heater_autotune_start(id, PARAMETER_asmult(L_S, 4));
+				power_on();
+			}
+			else if (autotune.heater != 255)
+				heater_autotune_abort(PSTR("autotune: aborted\n"));
+			break;
+		#endif /* BANG_BANG */
+	}
 }
-#endif  E_STARTSTOP_STEPS > 0 
 
+/*
 void heater_gcode_process(void){
 	case 'M':
 		case 2:
@@ -511,14 +749,6 @@ void heater_gcode_process(void){
 			}
 			#ifdef DC_EXTRUDER
 				// FIXME heater_set(DC_EXTRUDER, DC_EXTRUDER_PWM);
-			#elif E_STARTSTOP_STEPS > 0
-				do {
-					// backup feedrate, move E very quickly then restore feedrate
-					backup_f = startpoint.F;
-					startpoint.F = MAXIMUM_FEEDRATE_E;
-					SpecialMoveE(E_STARTSTOP_STEPS, MAXIMUM_FEEDRATE_E);
-					startpoint.F = backup_f;
-				} while (0);
 			#endif
 			break;
 
@@ -532,14 +762,6 @@ void heater_gcode_process(void){
 				//? Undocumented.
 				#ifdef DC_EXTRUDER
 					heater_set(DC_EXTRUDER, 0);
-				#elif E_STARTSTOP_STEPS > 0
-					do {
-						// backup feedrate, move E very quickly then restore feedrate
-						backup_f = startpoint.parameters[L_F];
-						startpoint.parameters[L_F] = MAXIMUM_FEEDRATE_E;
-						SpecialMoveE(-E_STARTSTOP_STEPS, MAXIMUM_FEEDRATE_E);
-						startpoint.parameters[L_F] = backup_f;
-					} while (0);
 				#endif
 				break;
 			// FIXME extruder temp 
@@ -620,57 +842,6 @@ void heater_gcode_process(void){
 			enqueue(NULL);
 			break;
 
-		case 130:
-			//? --- M130: heater P factor ---
-			//? Undocumented.
-			if (next_target.seen_S)
-				pid_set_p(next_target.P, next_target.S);
-			break;
-
-		case 131:
-			//? --- M131: heater I factor ---
-			//? Undocumented.
-			if (next_target.seen_S)
-				pid_set_i(next_target.P, next_target.S);
-			break;
-
-		case 132:
-			//? --- M132: heater D factor ---
-			//? Undocumented.
-			if (next_target.seen_S)
-				pid_set_d(next_target.P, next_target.S);
-			break;
-
-		case 133:
-			//? --- M133: heater I limit ---
-			//? Undocumented.
-			if (next_target.seen_S)
-				pid_set_i_limit(next_target.P, next_target.S);
-			break;
-
-		case 134:
-			//? --- M134: save PID settings to eeprom ---
-			//? Undocumented.
-			heater_save_settings();
-			break;
-
-		case 135:
-			//? --- M135: set heater output ---
-			//? Undocumented.
-			if (next_target.seen_S) {
-				heater_set(next_target.P, next_target.S);
-				power_on();
-			}
-			break;
-
-		#ifdef	DEBUG
-		case 136:
-			//? --- M136: PRINT PID settings to host ---
-			//? Undocumented.
-			//? This comand is only available in DEBUG builds.
-			heater_print(next_target.P);
-			break;
-		#endif
 		case 140:
 			//? --- M140: Set heated bed temperature ---
 			//? Undocumented.
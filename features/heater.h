@@ -0,0 +1,35 @@
+#ifndef HEATER_H
+#define HEATER_H
+
+#include	"heater_model.h"
+#include	"heater_pid.h"
+#include	"softpwm.h"
+
+/// \struct heater_t
+/// \brief simply holds pinout data- pin and pwm channel if used
+typedef struct heater_t {
+	uint8_t                pin;            ///< arduino pin number of heater output
+	volatile uint8_t      *pwm;            ///< pointer to 8-bit PWM register, eg OCR0A (8-bit) or ORC3L (low byte, 16-bit), 0 - no hardware PWM
+	const softpwm_config_t *softpwm;       ///< software PWM settings for pins without hardware PWM, 0 - plain on/off output
+} heater_t;
+
+/// \brief this struct holds the runtime heater data- PID integrator history, temperature history, sanity checker
+typedef struct heater_runtime_t {
+	heater_pid_state_t     pid;            ///< PID integrator and temperature history, see heater_pid_step()
+
+	#ifdef	HEATER_SANITY_CHECK
+		uint16_t               sanity_counter;   ///< how long things haven't seemed sane
+		uint16_t               sane_temperature; ///< a temperature we consider sane given the heater settings
+	#endif
+
+	uint8_t                heater_output;  ///< this is the PID value we eventually send to the heater
+	uint8_t                softpwm;        ///< software PWM channel, 255 - none
+} heater_runtime_t;
+
+extern const heater_t                heaters[];
+extern const uint8_t                 heaters_count;
+extern       heater_runtime_t        heaters_runtime[];
+extern       heater_pid_t            heaters_pid[];
+extern       heater_model_t          heaters_model[];
+
+#endif
@@ -0,0 +1,333 @@
+#include	"common.h"
+#include	"axes.h"
+#include	"dda_maths.h"
+#include	<math.h>
+
+// CONFIGURATION
+#define KINEMATICS           KINEMATICS_COREXY // KINEMATICS_COREXY (also H-bot) or KINEMATICS_DELTA
+#define DELTA_DIAGONAL_ROD   250000     // um, length of the rods from carriage to effector, joint to joint
+#define DELTA_RADIUS         124000     // um, horizontal distance from the center to a carriage with the effector in the center
+#define DELTA_SEGMENT          2000     // um, moves are split into pieces this long in X/Y
+// END OF CONFIGURATION
+
+#define KINEMATICS_COREXY    1
+#define KINEMATICS_DELTA     2
+
+API void kinematics_init(void);
+
+/** \file
+	\brief Kinematics for machines whose motors don't each move one of X, Y and Z
+
+	The axis entries for X, Y and Z in config_axes.c then describe motors. position_curr of an
+	axis is still the coordinate of its letter, position_motor where its motor is.
+
+	CoreXY and H-bot: X is motor A, Y is motor B, with A = X + Y and B = X - Y. Both need the same
+	steps per mm. Endstops are the X and Y switches of the carriage, X homes with both motors
+	turning alike, Y with them turning against each other, one after the other. Lines stay lines
+	for the motors, so moves are queued as they come.
+
+	Linear delta: X, Y and Z are the carriages of towers A (front left), B (front right) and C
+	(back), their position_max is the carriage height at the max endstop, the same for all three.
+	A carriage is at z + sqrt(DELTA_DIAGONAL_ROD^2 - d^2) for the effector at x, y, z, with d the
+	horizontal distance from its tower, calculated with 64 bit squares. That's no line, so moves
+	are split into DELTA_SEGMENT long pieces, each of them a line for the carriages. Homing always
+	runs all carriages up to their max endstop, the effector is then centered.
+
+	Like without kinematics each motor runs at F along its own distance.
+
+	For M114 the actual position goes the other way, from the motors to X, Y and Z: CoreXY takes
+	half the sum and half the difference, a delta intersects the three spheres of rod length
+	around the carriages in floating point, it's not in any move's path.
+*/
+
+/// axis entries of X, Y and Z, 0 if there is none
+static axis_t *kinematics_axes[3];
+
+/// queue homing of a plain axis, e.g. Z of a CoreXY
+static uint8_t kinematics_home_plain(axis_t *axis, uint8_t max){
+	if(!axis->proto->func_home)
+		return 0;
+	return axis->proto->func_home(axis, max, axis, 0);
+}
+
+/// make the step counter of an idle motor match position_motor
+static void kinematics_set_motor(axis_t *axis, int32_t position){
+	axis->runtime.position_motor = position;
+	if(axis->proto->func_set_position)
+		axis->proto->func_set_position(axis);
+}
+
+/// actual motor positions of X, Y and Z (um), 0 if one of them can't tell
+static uint8_t kinematics_motors(int32_t *motor){
+	uint8_t                i;
+
+	for(i = 0; i < 3; i++){
+		if(!kinematics_axes[i]->proto->func_position)
+			return 0;
+		motor[i] = kinematics_axes[i]->proto->func_position(kinematics_axes[i]);
+	}
+	return 1;
+}
+
+#if KINEMATICS == KINEMATICS_COREXY
+
+/// motors from the coordinates, the queue is empty
+static void kinematics_sync(void){
+	int32_t                x                 = kinematics_axes[0]->runtime.position_curr;
+	int32_t                y                 = kinematics_axes[1]->runtime.position_curr;
+
+	kinematics_set_motor(kinematics_axes[0], x + y);
+	kinematics_set_motor(kinematics_axes[1], x - y);
+	kinematics_set_motor(kinematics_axes[2], kinematics_axes[2]->runtime.position_curr);
+}
+
+static uint8_t kinematics_move(void *next_target){
+	GCODE_COMMAND          motors            = *(GCODE_COMMAND *)next_target;
+	int32_t                x, y;
+
+	if(PARAMETER_SEEN(L_X) || PARAMETER_SEEN(L_Y)){
+		x = PARAMETER_SEEN(L_X) ? PARAMETER_asint(L_X) : kinematics_axes[0]->runtime.position_curr;
+		y = PARAMETER_SEEN(L_Y) ? PARAMETER_asint(L_Y) : kinematics_axes[1]->runtime.position_curr;
+
+		PARAMETER_SET(&motors, L_X, x + y);
+		PARAMETER_SET(&motors, L_Y, x - y);
+	}
+
+	axes_queue_motors(&motors);
+	return 1;
+}
+
+static uint8_t kinematics_position(int32_t *xyz){
+	int32_t                motor[3];
+
+	if(!kinematics_motors(motor))
+		return 0;
+
+	xyz[0] = (motor[0] + motor[1]) / 2;
+	xyz[1] = (motor[0] - motor[1]) / 2;
+	xyz[2] = motor[2];
+	return 1;
+}
+
+static uint8_t kinematics_home(axis_t *axis, uint8_t max){
+	axis_t                *a                 = kinematics_axes[0];
+	axis_t                *b                 = kinematics_axes[1];
+
+	if(axis == kinematics_axes[2])
+		return kinematics_home_plain(axis, max);
+
+	if(!a->proto->func_home || !b->proto->func_home)
+		return 0;
+
+	// X and Y both need both motors, home them one after the other
+	axes_barrier_wait();
+
+	if(axis == a)
+		return a->proto->func_home(a, max, a, 0) && b->proto->func_home(b, max, a, 0);
+	else
+		return a->proto->func_home(a, max, b, 0) && b->proto->func_home(b, max, b, 1);
+}
+
+#elif KINEMATICS == KINEMATICS_DELTA
+
+/// horizontal position of the towers (um), A, B and C
+static int32_t kinematics_tower_x[3];
+static int32_t kinematics_tower_y[3];
+
+/// homing of all carriages is queued
+static uint8_t kinematics_homing;
+
+/** \brief carriage heights for an effector position
+	\param carriage filled with the height of carriage A, B and C (um)
+	\return 0 if a tower can't reach x, y
+*/
+static uint8_t kinematics_delta(int32_t x, int32_t y, int32_t z, int32_t *carriage){
+	int64_t                dx, dy, h;
+	uint8_t                i;
+
+	for(i = 0; i < 3; i++){
+		dx = x - kinematics_tower_x[i];
+		dy = y - kinematics_tower_y[i];
+		h  = (int64_t)DELTA_DIAGONAL_ROD * DELTA_DIAGONAL_ROD - dx * dx - dy * dy;
+		if(h <= 0)
+			return 0;
+
+		carriage[i] = z + int_sqrt64(h);
+	}
+	return 1;
+}
+
+static void kinematics_sync(void){
+	int32_t                carriage[3];
+	uint8_t                i;
+
+	if(!kinematics_delta(kinematics_axes[0]->runtime.position_curr, kinematics_axes[1]->runtime.position_curr,
+	                     kinematics_axes[2]->runtime.position_curr, carriage))
+		return;
+
+	for(i = 0; i < 3; i++)
+		kinematics_set_motor(kinematics_axes[i], carriage[i]);
+}
+
+static uint8_t kinematics_move(void *next_target){
+	GCODE_COMMAND          motors;
+	axis_t                *axis;
+	int32_t                start[3], dist[3], carriage[3];
+	uint32_t               segments;
+	uint32_t               k;
+	uint8_t                i;
+
+	// the area a tower reaches is a circle, if start and target are in reach, all between is
+	for(i = 0; i < 3; i++){
+		start[i] = kinematics_axes[i]->runtime.position_curr;
+		dist[i]  = PARAMETER_SEEN(kinematics_axes[i]->letter) ? PARAMETER_asint(kinematics_axes[i]->letter) - start[i] : 0;
+	}
+	if(!kinematics_delta(start[0] + dist[0], start[1] + dist[1], start[2] + dist[2], carriage)){
+		serial_writestr_P(PSTR("delta: out of reach "));
+		return 0;
+	}
+
+	// Z alone moves all carriages alike
+	segments = (approx_distance(labs(dist[0]), labs(dist[1])) + DELTA_SEGMENT - 1) / DELTA_SEGMENT;
+	if(!segments)
+		segments = 1;
+
+	for(k = 1; k <= segments; k++){
+		motors.seen = 0;
+		PARAMETER_SET(&motors, L_G, PARAMETER_asint(L_G));
+		motors.parameters[L_F] = ((GCODE_COMMAND *)next_target)->parameters[L_F];
+
+		kinematics_delta(start[0] + muldiv(dist[0], k, segments), start[1] + muldiv(dist[1], k, segments),
+		                 start[2] + muldiv(dist[2], k, segments), carriage);
+		for(i = 0; i < 3; i++){
+			if(carriage[i] != kinematics_axes[i]->runtime.position_motor)
+				PARAMETER_SET(&motors, kinematics_axes[i]->letter, carriage[i]);
+		}
+
+		// E and any other axes move along
+		for(i = 0; i < axes_count; i++){
+			axis = &axes[i];
+			if(axis == kinematics_axes[0] || axis == kinematics_axes[1] || axis == kinematics_axes[2] || !PARAMETER_SEEN(axis->letter))
+				continue;
+			PARAMETER_SET(&motors, axis->letter,
+				axis->runtime.position_curr + muldiv(PARAMETER_asint(axis->letter) - axis->runtime.position_curr, k, segments));
+		}
+
+		axes_queue_motors(&motors);
+	}
+	return 1;
+}
+
+static uint8_t kinematics_position(int32_t *xyz){
+	int32_t                motor[3];
+	float                  b[3], c[3], ex[3], ey[3], ez[3];
+	float                  d, i, j, n, x, y, z;
+	uint8_t                k;
+
+	if(!kinematics_motors(motor))
+		return 0;
+
+	// joints of carriages B and C relative to the one of A
+	b[0] = kinematics_tower_x[1] - kinematics_tower_x[0];
+	b[1] = kinematics_tower_y[1] - kinematics_tower_y[0];
+	b[2] = motor[1] - motor[0];
+	c[0] = kinematics_tower_x[2] - kinematics_tower_x[0];
+	c[1] = kinematics_tower_y[2] - kinematics_tower_y[0];
+	c[2] = motor[2] - motor[0];
+
+	// ex towards B, ey towards C in the plane of the joints, ez perpendicular to both
+	d = sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+	for(k = 0; k < 3; k++)
+		ex[k] = b[k] / d;
+	i = ex[0] * c[0] + ex[1] * c[1] + ex[2] * c[2];
+	for(k = 0; k < 3; k++)
+		ey[k] = c[k] - i * ex[k];
+	n = sqrt(ey[0] * ey[0] + ey[1] * ey[1] + ey[2] * ey[2]);
+	for(k = 0; k < 3; k++)
+		ey[k] /= n;
+	j = ey[0] * c[0] + ey[1] * c[1] + ey[2] * c[2];
+	ez[0] = ex[1] * ey[2] - ex[2] * ey[1];
+	ez[1] = ex[2] * ey[0] - ex[0] * ey[2];
+	ez[2] = ex[0] * ey[1] - ex[1] * ey[0];
+
+	// all rods are equally long, the effector is below the joints
+	x = d / 2;
+	y = (i * i + j * j) / (2 * j) - i * x / j;
+	z = (float)DELTA_DIAGONAL_ROD * DELTA_DIAGONAL_ROD - x * x - y * y;
+	if(z < 0)
+		return 0;
+	z = sqrt(z);
+	if(ez[2] > 0)
+		z = -z;
+
+	xyz[0] = lround(kinematics_tower_x[0] + x * ex[0] + y * ey[0] + z * ez[0]);
+	xyz[1] = lround(kinematics_tower_y[0] + x * ex[1] + y * ey[1] + z * ez[1]);
+	xyz[2] = lround(motor[0]              + x * ex[2] + y * ey[2] + z * ez[2]);
+	return 1;
+}
+
+static uint8_t kinematics_home(axis_t *axis, uint8_t max){
+	uint8_t                i;
+
+	// towers have max endstops only, and all of them home together
+	if(!max)
+		return 0;
+	if(kinematics_homing)
+		return 1;
+
+	for(i = 0; i < 3; i++){
+		if(!kinematics_home_plain(kinematics_axes[i], 1)){
+			serial_writestr_P(PSTR("delta: all towers need max endstops "));
+			return 0;
+		}
+	}
+	kinematics_homing = 1;
+	return 1;
+}
+
+#endif
+
+static void kinematics_homed(axis_t *axis, uint8_t max){
+	#if KINEMATICS == KINEMATICS_DELTA
+		int32_t                height            = kinematics_axes[2]->position_max;
+
+		// effector centered below the carriages
+		kinematics_homing = 0;
+		kinematics_axes[0]->runtime.position_curr = 0;
+		kinematics_axes[1]->runtime.position_curr = 0;
+		kinematics_axes[2]->runtime.position_curr = height -
+			int_sqrt64((int64_t)DELTA_DIAGONAL_ROD * DELTA_DIAGONAL_ROD - (int64_t)DELTA_RADIUS * DELTA_RADIUS);
+	#else
+		axis->runtime.position_curr = max ? axis->position_max : axis->position_min;
+	#endif
+
+	kinematics_sync();
+}
+
+static const axes_kinematics_t kinematics = {
+	.move     = &kinematics_move,
+	.home     = &kinematics_home,
+	.homed    = &kinematics_homed,
+	.position = &kinematics_position,
+};
+
+void kinematics_init(void){
+	kinematics_axes[0] = axes_find(L_X);
+	kinematics_axes[1] = axes_find(L_Y);
+	kinematics_axes[2] = axes_find(L_Z);
+	if(!kinematics_axes[0] || !kinematics_axes[1] || !kinematics_axes[2])
+		return;
+
+	#if KINEMATICS == KINEMATICS_DELTA
+		// towers 120 degrees apart, cos(30 degrees) = 56756 / 65536
+		kinematics_tower_x[0] = -muldiv(DELTA_RADIUS, 56756, 65536);
+		kinematics_tower_y[0] = -DELTA_RADIUS / 2;
+		kinematics_tower_x[1] =  muldiv(DELTA_RADIUS, 56756, 65536);
+		kinematics_tower_y[1] = -DELTA_RADIUS / 2;
+		kinematics_tower_x[2] =  0;
+		kinematics_tower_y[2] =  DELTA_RADIUS;
+	#endif
+
+	kinematics_sync();
+	axes_set_kinematics(&kinematics);
+}
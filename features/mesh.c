@@ -0,0 +1,379 @@
+#define FEATURE
+#include	"common.h"
+#include	"axes.h"
+#include	"dda_maths.h"
+
+// CONFIGURATION
+#define MESH_POINTS_X        3          // probe points along X, at least 2
+#define MESH_POINTS_Y        3          // probe points along Y, at least 2
+#define MESH_MIN_X       20000          // um, area probed by G29
+#define MESH_MAX_X      180000
+#define MESH_MIN_Y       20000
+#define MESH_MAX_Y      180000
+#define MESH_FADE        10000          // um, height the correction fades out at, 0 - never. Change with M420 Z
+#define MESH_CLEARANCE    5000          // um, height to move between probe points at
+#define MESH_PROBE_DEPTH  5000          // um, how far below Z = 0 to search for the bed
+// END OF CONFIGURATION
+
+API void mesh_init(void);
+
+/** \file
+	\brief Mesh bed leveling
+
+	G29 probes the bed on a grid of MESH_POINTS_X by MESH_POINTS_Y points, with the Z min endstop
+	as probe. Heights are saved by M500.
+
+	G0/G1 moves and arc chords then go through mesh_move(). Z gets the bed height at the
+	current X, Y added, interpolated bilinearly between the four points around with 8 bit
+	fractions. Between grid lines the bed is taken as flat, so moves are split where they cross a
+	grid line and each piece is a straight line again. Above MESH_FADE the correction is gone and
+	moves are queued as they come.
+
+	Z has a queue of its own, so each Z piece gets a feedrate which makes it last as long as X
+	and Y take for theirs. With kinematics Z moves the same motors as X and Y, pieces go to the
+	kinematics in one.
+
+	position_curr of Z includes the correction, mesh_applied says how much of it.
+*/
+
+#define MESH_STEP_X          ((MESH_MAX_X - MESH_MIN_X) / (MESH_POINTS_X - 1))
+#define MESH_STEP_Y          ((MESH_MAX_Y - MESH_MIN_Y) / (MESH_POINTS_Y - 1))
+#define MESH_ONE             65536      // fractions of a move are 16.16 fixed point
+
+typedef struct mesh_settings_t {
+	uint8_t                enabled;                         ///< correction on, M420 S
+	int32_t                fade;                            ///< height the correction is gone at (um), 0 - never
+	int16_t                z[MESH_POINTS_Y][MESH_POINTS_X]; ///< bed height at each point (um)
+} mesh_settings_t;
+
+/// saved by M500
+static mesh_settings_t mesh = { 0, MESH_FADE };
+
+/// correction included in position_curr of the Z axis (um)
+static int32_t         mesh_applied = 0;
+
+/// grid cell a coordinate is in, and the position in it in 1/256
+static uint8_t mesh_cell(int32_t v, int32_t step, uint8_t points, int32_t *fraction){
+	uint8_t                i;
+
+	if(v < 0)
+		v = 0;
+	if(v > step * (points - 1))
+		v = step * (points - 1);
+
+	i = v / step;
+	if(i > points - 2)
+		i = points - 2;
+
+	*fraction = ((v - i * step) << 8) / step;
+	return i;
+}
+
+/// bed height (um) at x, y. Outside the grid the edge heights continue
+static int32_t mesh_height(int32_t x, int32_t y){
+	uint8_t                i, j;
+	int32_t                fx, fy, a, b;
+
+	i = mesh_cell(x - MESH_MIN_X, MESH_STEP_X, MESH_POINTS_X, &fx);
+	j = mesh_cell(y - MESH_MIN_Y, MESH_STEP_Y, MESH_POINTS_Y, &fy);
+
+	a = ((int32_t)mesh.z[j    ][i] * (256 - fx) + (int32_t)mesh.z[j    ][i + 1] * fx) >> 8;
+	b = ((int32_t)mesh.z[j + 1][i] * (256 - fx) + (int32_t)mesh.z[j + 1][i + 1] * fx) >> 8;
+
+	return (a * (256 - fy) + b * fy) >> 8;
+}
+
+/// correction to add to Z at x, y and height z (um)
+static int32_t mesh_correction(int32_t x, int32_t y, int32_t z){
+	int32_t                h;
+
+	if(!mesh.enabled || (mesh.fade && z >= mesh.fade))
+		return 0;
+
+	h = mesh_height(x, y);
+	if(mesh.fade && z > 0)
+		h = muldiv(h, mesh.fade - z, mesh.fade);
+	return h;
+}
+
+/// fraction of the way from a to b where the first grid line after fraction t is, MESH_ONE if none
+static uint32_t mesh_next_line(int32_t a, int32_t b, uint32_t t, int32_t min, int32_t step, uint8_t points){
+	uint32_t               next              = MESH_ONE;
+	uint32_t               f;
+	int32_t                line;
+	uint8_t                k;
+
+	for(k = 0; k < points; k++){
+		line = min + k * step;
+		if(a < line && line < b)
+			f = muldiv(line - a, MESH_ONE, b - a);
+		else if(b < line && line < a)
+			f = muldiv(a - line, MESH_ONE, a - b);
+		else
+			continue;
+
+		if(f > t && f < next)
+			next = f;
+	}
+	return next;
+}
+
+/// feedrate (mm/min) which makes Z move dz in the time X and Y take for dx, dy. Each axis runs
+/// at the feedrate of the move on its own, the one which takes longest sets the time
+static uint32_t mesh_z_feedrate(void *next_target, axis_t *ax, axis_t *ay, axis_t *az, int32_t dx, int32_t dy, int32_t dz){
+	uint8_t                rapid             = PARAMETER_asint(L_G) == 0;
+	uint32_t               fx                = rapid ? ax->feedrate_max : (uint32_t)PARAMETER_asint(L_F);
+	uint32_t               fy                = rapid ? ay->feedrate_max : (uint32_t)PARAMETER_asint(L_F);
+	uint32_t               f                 = az->feedrate_max;
+	uint32_t               fz;
+
+	dx = labs(dx);
+	dy = labs(dy);
+	dz = labs(dz);
+	if(dx){
+		fz = muldiv(dz, fx, dx);
+		if(fz < f)
+			f = fz;
+	}
+	if(dy){
+		fz = muldiv(dz, fy, dy);
+		if(fz < f)
+			f = fz;
+	}
+	if(!dx && !dy && !rapid && fx < f)
+		f = fx;
+	return f ? f : 1;
+}
+
+/// the planner: correct Z for the bed and split moves at grid lines
+void mesh_move(void *next_target){
+	GCODE_COMMAND          piece;
+	axis_t                *ax                = axes_find(L_X);
+	axis_t                *ay                = axes_find(L_Y);
+	axis_t                *az                = axes_find(L_Z);
+	axis_t                *ae                = axes_find(L_E);
+	int32_t                x0, y0, z0, e0, dx, dy, dz, de, x, y, z;
+	int32_t                px, py, pz;
+	uint32_t               t, next, ty;
+
+	if(!ax || !ay || !az){
+		axes_queue(next_target);
+		return;
+	}
+
+	// start and distance, Z without the correction
+	x0 = ax->runtime.position_curr;
+	y0 = ay->runtime.position_curr;
+	z0 = az->runtime.position_curr - mesh_applied;
+	e0 = ae ? ae->runtime.position_curr : 0;
+	dx = PARAMETER_SEEN(L_X) ? PARAMETER_asint(L_X) - x0 : 0;
+	dy = PARAMETER_SEEN(L_Y) ? PARAMETER_asint(L_Y) - y0 : 0;
+	dz = 0;
+	if(PARAMETER_SEEN(L_Z)){
+		// relative moves were made absolute from position_curr, which includes the correction
+		z  = PARAMETER_asint(L_Z);
+		if(az->runtime.relative)
+			z -= mesh_applied;
+		dz = z - z0;
+	}
+	de = (ae && PARAMETER_SEEN(L_E)) ? PARAMETER_asint(L_E) - e0 : 0;
+
+	// nothing to correct, nor any correction to take out
+	if(!mesh_applied && (!mesh.enabled || (mesh.fade && z0 >= mesh.fade && z0 + dz >= mesh.fade))){
+		axes_queue(next_target);
+		return;
+	}
+
+	// end of the previous piece, Z with the correction
+	px = x0;
+	py = y0;
+	pz = az->runtime.position_curr;
+
+	t = 0;
+	do{
+		next = MESH_ONE;
+		if(mesh.enabled){
+			next = mesh_next_line(x0, x0 + dx, t, MESH_MIN_X, MESH_STEP_X, MESH_POINTS_X);
+			ty   = mesh_next_line(y0, y0 + dy, t, MESH_MIN_Y, MESH_STEP_Y, MESH_POINTS_Y);
+			if(ty < next)
+				next = ty;
+		}
+		t = next;
+
+		x = x0 + muldiv(dx, t, MESH_ONE);
+		y = y0 + muldiv(dy, t, MESH_ONE);
+		z = z0 + muldiv(dz, t, MESH_ONE);
+		mesh_applied = mesh_correction(x, y, z);
+
+		z += mesh_applied;
+
+		piece.seen = 0;
+		PARAMETER_SET(&piece, L_G, PARAMETER_asint(L_G));
+		PARAMETER_SET(&piece, L_X, x);
+		PARAMETER_SET(&piece, L_Y, y);
+		if(de)
+			PARAMETER_SET(&piece, L_E, e0 + muldiv(de, t, MESH_ONE));
+		piece.parameters[L_F] = ((GCODE_COMMAND *)next_target)->parameters[L_F];
+
+		if(axes_kinematic(az)){
+			PARAMETER_SET(&piece, L_Z, z);
+			axes_queue(&piece);
+		}else{
+			axes_queue(&piece);
+
+			if(z != pz){
+				piece.seen = 0;
+				PARAMETER_SET(&piece, L_G, 1);
+				PARAMETER_SET(&piece, L_Z, z);
+				PARAMETER_SET(&piece, L_F, mesh_z_feedrate(next_target, ax, ay, az, x - px, y - py, z - pz));
+				axes_queue(&piece);
+			}
+		}
+
+		px = x;
+		py = y;
+		pz = z;
+	}while(t < MESH_ONE);
+}
+
+/// rapid move to the clearance height, then to x, y. Barriers keep X/Y from starting before Z
+/// is up and the probe from starting before X/Y arrived, each axis has its own queue
+static void mesh_travel(int32_t x, int32_t y){
+	GCODE_COMMAND          travel;
+
+	travel.seen = 0;
+	PARAMETER_SET(&travel, L_G, 0);
+	PARAMETER_SET(&travel, L_Z, MESH_CLEARANCE);
+	axes_queue(&travel);
+	axes_barrier(0, 0);
+
+	travel.seen = 0;
+	PARAMETER_SET(&travel, L_G, 0);
+	PARAMETER_SET(&travel, L_X, x);
+	PARAMETER_SET(&travel, L_Y, y);
+	axes_queue(&travel);
+	axes_barrier(0, 0);
+}
+
+/// print the probed heights, one row per line, front row last
+static void mesh_report(void){
+	uint8_t                i, j;
+
+	sersendf_P(PSTR("mesh S%u Z%lq\n"), mesh.enabled, mesh.fade);
+	for(j = MESH_POINTS_Y; j; j--){
+		for(i = 0; i < MESH_POINTS_X; i++)
+			sersendf_P(PSTR("%lq "), (int32_t)mesh.z[j - 1][i]);
+		serial_writechar('\n');
+	}
+}
+
+/// probe all points and turn the correction on. Without a bed at one of them, the correction
+/// stays off
+static void mesh_probe(void){
+	axis_t                *ax                = axes_find(L_X);
+	axis_t                *ay                = axes_find(L_Y);
+	axis_t                *az                = axes_find(L_Z);
+	uint8_t                i, j, n;
+	int32_t                x, y, h;
+
+	if(!ax || !ay || !az || !az->proto->func_probe || !az->proto->func_position){
+		serial_writestr_P(PSTR("mesh: no Z probe "));
+		return;
+	}
+
+	// plain machine coordinates while probing
+	mesh.enabled = 0;
+	mesh_applied = 0;
+
+	for(j = 0; j < MESH_POINTS_Y; j++){
+		for(n = 0; n < MESH_POINTS_X; n++){
+			// back and forth, saves travel
+			i = (j & 1) ? MESH_POINTS_X - 1 - n : n;
+
+			x = MESH_MIN_X + i * MESH_STEP_X;
+			y = MESH_MIN_Y + j * MESH_STEP_Y;
+			mesh_travel(x, y);
+			if(!az->proto->func_probe(az, -MESH_PROBE_DEPTH)){
+				serial_writestr_P(PSTR("mesh: no Z min endstop "));
+				return;
+			}
+			axes_barrier_wait();
+
+			h = az->proto->func_position(az);
+			az->runtime.position_curr  = h;
+			az->runtime.position_motor = h;
+
+			// went all the way down, within a step: there's no bed, or the probe doesn't work
+			if(h <= -MESH_PROBE_DEPTH + (int32_t)(1000000UL / az->steps_per_m) + 1){
+				sersendf_P(PSTR("!! mesh: probe didn't trigger at X%lq Y%lq\n"), x, y);
+				mesh_travel(x, y);
+				return;
+			}
+			mesh.z[j][i] = constrain(h, -32767, 32767);
+		}
+	}
+	mesh_travel(ax->runtime.position_curr, ay->runtime.position_curr);
+
+	mesh.enabled = 1;
+	mesh_report();
+}
+
+void mesh_gcode_process(void *next_target){
+	uint8_t                i;
+	uint8_t                any               = 0;
+
+	if(PARAMETER_SEEN(L_G)){
+		switch(PARAMETER_asint(L_G)){
+			case 28:
+			case 161:
+			case 162:
+				// axes did their homing already. Z homed means there's no correction in its position
+				for(i = 0; i < axes_count; i++){
+					if(PARAMETER_SEEN(axes[i].letter))
+						any = 1;
+				}
+				if(!any || PARAMETER_SEEN(L_Z))
+					mesh_applied = 0;
+				break;
+
+			case 29:
+				//? --- G29: Mesh Bed Probing ---
+				//?
+				//? Example: G29
+				//?
+				//? Probe the bed height on a grid with the Z min endstop, then correct Z of all moves for
+				//? it, see M420. Home first. Save the result with M500.
+				//?
+				mesh_probe();
+				break;
+		}
+	}
+
+	if(PARAMETER_SEEN(L_M)){
+		switch(PARAMETER_asint(L_M)){
+			case 420:
+				//? --- M420: Mesh Bed Leveling State ---
+				//?
+				//? Example: M420 S1 Z10
+				//?
+				//? S1 turns the correction from G29 on, S0 off. Z sets the height in mm it fades out
+				//? up to, Z0 keeps it on for the whole print. Without parameters the probed heights
+				//? are reported. Save with M500.
+				//?
+				if(PARAMETER_SEEN(L_S))
+					mesh.enabled = PARAMETER_asint(L_S) ? 1 : 0;
+				if(PARAMETER_SEEN(L_Z))
+					mesh.fade = PARAMETER_asmult(L_Z, 1000);
+				if(!PARAMETER_SEEN(L_S) && !PARAMETER_SEEN(L_Z))
+					mesh_report();
+				break;
+		}
+	}
+}
+
+void mesh_init(void){
+	settings_register(&mesh, sizeof(mesh), 0);
+
+	axes_set_planner(&mesh_move);
+	core_register(EVENT_GCODE_PROCESS, &mesh_gcode_process);
+}
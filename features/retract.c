@@ -0,0 +1,173 @@
+#include	"common.h"
+#include	"axes.h"
+
+// CONFIGURATION
+#define RETRACT_LENGTH       1000       // um, how far G10 pulls the filament back. Change with M207 S
+#define RETRACT_FEEDRATE     2400       // mm/min, of G10 and G11. Change with M207 F
+#define RETRACT_HOP             0       // um, how far G10 lifts Z, 0 - not at all. Change with M207 Z
+// END OF CONFIGURATION
+
+API void retract_init(void);
+
+#define RETRACT_MAX         50000       ///< um, longest retract and highest Z hop M207 accepts
+
+/** \file
+	\brief Firmware retraction, G10 and G11
+
+	Slicers set to firmware retraction send G10 instead of a G1 pulling the filament back and G11
+	instead of the one pushing it forward again. Length, speed and Z hop are set on the printer with
+	M207, so they can be tuned while printing.
+
+	Both E moves are precalculated with func_prepare of the E axis and just copied into its queue
+	from then on, no conversions and no dda_create() per retract. They're calculated again once
+	M207, M92, M221 or a tool change with another extruder motor changed them. Position of E
+	doesn't change, after G11 it's where it was before G10.
+
+	Z hop is a G0 lifting Z. G11 lowers it again, unless Z moved in between, e.g. to the next
+	layer, which left the lifted height already.
+
+	Axes queue independently, so both are fenced by barriers: they start once the moves before
+	finished on all axes, the travel after G10 or the print move after G11 waits for them.
+*/
+
+typedef struct retract_settings_t {
+	uint32_t               length;                 ///< um
+	uint32_t               feedrate;               ///< mm/min
+	uint32_t               hop;                    ///< um
+} retract_settings_t;
+
+/// saved by M500
+static retract_settings_t retract = { RETRACT_LENGTH, RETRACT_FEEDRATE, RETRACT_HOP };
+
+/// precalculated E moves, 0 - retract, 1 - recover
+static dda_t               retract_moves[2];
+static uint8_t             retract_valid;     ///< bit set for each of retract_moves not a null move
+static retract_settings_t  retract_prepared;  ///< settings retract_moves were calculated with
+static uint32_t            retract_steps;     ///< steps per meter of E they were calculated with, 0 - never
+static axis_t             *retract_axis;      ///< axis entry of E they were calculated for
+
+static uint8_t             retract_retracted; ///< G10 done, G11 not yet
+static uint32_t            retract_hopped;    ///< how far G10 lifted Z (um)
+static int32_t             retract_hop_z;     ///< Z after the lift
+
+/// calculate the E moves again if anything changed since the last time
+static void retract_prepare(axis_t *ae){
+	uint32_t               steps_per_m       = axis_steps_per_m(ae);
+
+	if(ae == retract_axis && steps_per_m == retract_steps && retract.length == retract_prepared.length &&
+	   retract.feedrate == retract_prepared.feedrate)
+		return;
+
+	retract_valid = 0;
+	if(ae->proto->func_prepare(ae, &retract_moves[0], -(int32_t)retract.length, retract.feedrate))
+		retract_valid |= 1;
+	if(ae->proto->func_prepare(ae, &retract_moves[1],  (int32_t)retract.length, retract.feedrate))
+		retract_valid |= 2;
+
+	retract_prepared = retract;
+	retract_steps    = steps_per_m;
+	retract_axis     = ae;
+}
+
+/// move Z by distance (um) at its maximum feedrate
+static void retract_hop(axis_t *az, int32_t distance){
+	GCODE_COMMAND          hop;
+
+	hop.seen = 0;
+	PARAMETER_SET(&hop, L_G, 0);
+	PARAMETER_SET(&hop, L_Z, az->runtime.position_curr + distance);
+	axes_queue(&hop);
+}
+
+/// G10 with recover 0, G11 with recover 1
+static void retract_run(uint8_t recover){
+	axis_t                *ae                = axes_find(L_E);
+	axis_t                *az                = axes_find(L_Z);
+
+	if(!ae || !ae->proto->func_prepare || !ae->proto->func_enqueue){
+		serial_writestr_P(PSTR("retract: E can't "));
+		return;
+	}
+
+	// twice the same does nothing, the slicer lost track
+	if(recover != retract_retracted)
+		return;
+	retract_retracted = !recover;
+
+	retract_prepare(ae);
+
+	// each axis has its own queue, don't start before X/Y arrived
+	axes_barrier(0, 0);
+
+	if(recover && retract_hopped && az->runtime.position_curr == retract_hop_z)
+		retract_hop(az, -(int32_t)retract_hopped);
+	retract_hopped = 0;
+
+	if(retract_valid & (1 << recover))
+		ae->proto->func_enqueue(ae, &retract_moves[recover]);
+
+	if(!recover && az && retract.hop){
+		retract_hop(az, retract.hop);
+		retract_hopped = retract.hop;
+		retract_hop_z  = az->runtime.position_curr;
+	}
+
+	// and travel or printing go on once E and Z are done
+	axes_barrier(0, 0);
+}
+
+void retract_gcode_process(void *next_target){
+	if(PARAMETER_SEEN(L_G)){
+		switch(PARAMETER_asint(L_G)){
+			case 10:
+				//? --- G10: Retract ---
+				//?
+				//? Example: G10
+				//?
+				//? Pull the filament back by the length set with M207 and lift Z, if set. Does nothing
+				//? if already retracted.
+				//?
+				retract_run(0);
+				break;
+
+			case 11:
+				//? --- G11: Recover ---
+				//?
+				//? Example: G11
+				//?
+				//? Undo G10: lower Z, unless it moved meanwhile, and push the filament forward again.
+				//?
+				retract_run(1);
+				break;
+		}
+	}
+
+	if(PARAMETER_SEEN(L_M)){
+		switch(PARAMETER_asint(L_M)){
+			case 207:
+				//? --- M207: set firmware retraction ---
+				//?
+				//? Example: M207 S1.5 F3000 Z0.2
+				//?
+				//? Set the length in mm G10 retracts, the feedrate in mm/min of G10 and G11 and how far
+				//? in mm Z gets lifted. Applies from the next G10 on, without parameters the settings
+				//? are reported. Save with M500.
+				//?
+				if(PARAMETER_SEEN(L_S))
+					retract.length   = constrain(PARAMETER_asmult(L_S, 1000), 0, RETRACT_MAX);
+				if(PARAMETER_SEEN(L_F) && PARAMETER_asint(L_F))
+					retract.feedrate = PARAMETER_asint(L_F);
+				if(PARAMETER_SEEN(L_Z))
+					retract.hop      = constrain(PARAMETER_asmult(L_Z, 1000), 0, RETRACT_MAX);
+				if(!PARAMETER_SEEN(L_S) && !PARAMETER_SEEN(L_F) && !PARAMETER_SEEN(L_Z))
+					sersendf_P(PSTR("retract S%lq F%lu Z%lq "), retract.length, retract.feedrate, retract.hop);
+				break;
+		}
+	}
+}
+
+void retract_init(void){
+	settings_register(&retract, sizeof(retract), 0);
+
+	core_register(EVENT_GCODE_PROCESS, &retract_gcode_process);
+}
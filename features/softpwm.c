@@ -0,0 +1,172 @@
+#define FEATURE
+#include "common.h"
+
+// CONFIGURATION
+
+/// number of software PWM channels. Each one takes a timer, see NUM_TIMERS in timer.c
+#define SOFTPWM_CHANNELS      3
+/// pulses or gaps shorter than this are dropped, so the output is fully off or on instead
+#define SOFTPWM_MIN_PULSE     (50 US)
+
+// END OF CONFIGURATION
+
+#include	"softpwm.h"
+
+API uint8_t softpwm_new(uint8_t pin, const softpwm_config_t *config);
+API void softpwm_set(uint8_t channel, uint8_t value);
+API void softpwm_init(void);
+
+/** \file
+	\brief Software PWM on any pin
+
+	Every channel runs on its own timer from timer.c, so it costs two interrupts per period no matter
+	what the resolution is. Pulse lengths are computed in softpwm_set() from the main loop, the timer
+	callback only toggles the pin and recharges itself.
+
+	Channels sharing a period are started with their phases spread evenly across it, so heaters don't
+	all switch on in the same instant.
+*/
+
+typedef struct softpwm_channel_t {
+	const softpwm_config_t *config;
+	uint8_t                pin;
+	uint8_t                timer_id;
+	uint8_t                value;          ///< last value given to softpwm_set()
+	uint8_t                high;           ///< pin is currently high
+	volatile uint8_t       kick_left;      ///< periods of kick-start still to go
+	volatile uint32_t      on_time;        ///< pulse length in CPU ticks, 0 - always off
+	volatile uint32_t      off_time;       ///< gap length in CPU ticks, 0 - always on
+} softpwm_channel_t;
+
+static softpwm_channel_t      softpwm_channels[SOFTPWM_CHANNELS];
+static uint8_t                softpwm_count = 0;
+
+/// timer callback, toggles the pin at the end of pulse and gap
+static void softpwm_timer(uint8_t id, void *userdata) {
+	softpwm_channel_t     *ch = (softpwm_channel_t *) userdata;
+
+	if (ch->high && ch->off_time && ! ch->kick_left) {
+		// end of pulse
+		digitalWrite(ch->pin, LOW);
+		ch->high = 0;
+		timer_charge(id, ch->off_time);
+		return;
+	}
+
+	// start of period
+	if (ch->kick_left) {
+		ch->kick_left--;
+		digitalWrite(ch->pin, HIGH);
+		ch->high = 1;
+		timer_charge(id, ch->config->period);
+	}
+	else if (ch->on_time == 0) {
+		digitalWrite(ch->pin, LOW);
+		ch->high = 0;
+		timer_charge(id, ch->config->period);
+	}
+	else {
+		digitalWrite(ch->pin, HIGH);
+		ch->high = 1;
+		timer_charge(id, ch->off_time ? ch->on_time : ch->config->period);
+	}
+}
+
+/** \brief set up a software PWM channel
+	\param pin arduino pin number
+	\param config channel settings, must stay valid forever
+	\return channel number for softpwm_set(), 255 if we ran out of channels or timers
+*/
+uint8_t softpwm_new(uint8_t pin, const softpwm_config_t *config) {
+	softpwm_channel_t     *ch;
+	uint8_t                timer_id;
+
+	if (softpwm_count >= SOFTPWM_CHANNELS || config->resolution == 0)
+		return 255;
+
+	timer_id = timer_new();
+	if (timer_id == 255)
+		return 255;
+
+	ch = &softpwm_channels[softpwm_count];
+	ch->config   = config;
+	ch->pin      = pin;
+	ch->timer_id = timer_id;
+
+	digitalWrite(pin, LOW);
+	pinMode(pin, OUTPUT);
+
+	// stagger phases: channel n starts n / SOFTPWM_CHANNELS into its period
+	timer_setup(timer_id, &softpwm_timer, ch);
+	timer_charge(timer_id, config->period / SOFTPWM_CHANNELS * softpwm_count + SOFTPWM_MIN_PULSE);
+
+	return softpwm_count++;
+}
+
+/** \brief set duty cycle of a software PWM channel
+	\param channel channel number from softpwm_new()
+	\param value duty cycle, 0 - off, 255 - fully on
+
+	Takes effect at the start of the next period.
+*/
+void softpwm_set(uint8_t channel, uint8_t value) {
+	softpwm_channel_t     *ch;
+	const softpwm_config_t *config;
+	uint8_t                level;
+	uint32_t               on, off;
+	uint8_t                sreg;
+
+	if (channel >= softpwm_count)
+		return;
+
+	ch     = &softpwm_channels[channel];
+	config = ch->config;
+
+	// quantise to the channel's resolution
+	level = ((uint16_t) value * config->resolution + 127) / 255;
+	on    = config->period / config->resolution * level;
+	if (level == config->resolution)
+		on = config->period;
+	off   = config->period - on;
+
+	if (on < SOFTPWM_MIN_PULSE) {
+		on  = 0;
+		off = config->period;
+	}
+	else if (off < SOFTPWM_MIN_PULSE) {
+		on  = config->period;
+		off = 0;
+	}
+
+	sreg = SREG;
+	cli();
+	ch->on_time  = on;
+	ch->off_time = off;
+	if (value == 0)
+		ch->kick_left = 0;
+	else if (ch->value == 0)
+		ch->kick_left = config->kick;
+	SREG = sreg;
+
+	ch->value = value;
+}
+
+/// emergency stop, every channel low and its timer off
+static void softpwm_emergency_stop(void *data) {
+	softpwm_channel_t     *ch;
+	uint8_t                i;
+
+	for (i = 0; i < softpwm_count; i++) {
+		ch = &softpwm_channels[i];
+		timer_disable(ch->timer_id);
+		digitalWrite(ch->pin, LOW);
+		ch->high      = 0;
+		ch->kick_left = 0;
+		ch->on_time   = 0;
+		ch->off_time  = ch->config->period;
+	}
+}
+
+void softpwm_init(void) {
+	core_register(EVENT_EMERGENCY_STOP, &softpwm_emergency_stop);
+}
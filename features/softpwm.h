@@ -0,0 +1,12 @@
+#ifndef SOFTPWM_H
+#define SOFTPWM_H
+
+/// \struct softpwm_config_t
+/// \brief settings of a software PWM channel, usually given as compound literal in the heaters table
+typedef struct softpwm_config_t {
+	uint32_t               period;         ///< PWM period in CPU ticks, eg 100 MS for 10 Hz
+	uint8_t                resolution;     ///< duty cycle steps per period. Coarser steps mean longer minimum pulses
+	uint8_t                kick;           ///< when switched on from off, run this many periods at full output first. 0 - no kick-start
+} softpwm_config_t;
+
+#endif
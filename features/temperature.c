@@ -19,21 +19,32 @@ we still need to specify which analog pins we use in machine.h for the analog se
 	\note \b ALL temperatures are stored as 14.2 fixed point in teacup, so we have a range of 0 - 16383.75 celsius and a precision of 0.25 celsius. That includes the ThermistorTable, which is why you can't copy and paste one from other firmwares which don't do this.
 */
 
-API void temp_tick(void);
+API void temp_init(void);
 API uint8_t	temp_achieved(void);
+API uint8_t temp_wait(uint8_t index);
 API void temp_set(uint8_t index, uint16_t temperature);
 API uint16_t temp_get(uint8_t index);
 API uint8_t temp_all_zero(void);
 API void temp_print(void);
+API typedef uint8_t (*temp_extruder_func)(void *next_target);
+API void temp_set_extruder(temp_extruder_func extruder);
 
 
 #include	<stdlib.h>
 
 #include	"debug.h"
+#include	"pinio.h"
 
+/// bit i is set while sensor i has been at its target for TEMP_RESIDENCY_TIME or has no target.
+/// A single byte, so it can be read from the step interrupt. Only the first 8 sensors are tracked.
+static volatile uint8_t       temp_achieved_mask = 0;
 
-/// called every 10ms from clock.c - check all temp sensors that are ready for checking
-void temp_tick() {
+/// sensor of the extruder M104 and M109 address without P, 0 - the one reported as 'T'
+static temp_extruder_func     temp_extruder = 0;
+
+
+/// called every 10ms from clock_poll() - check all temp sensors that are ready for checking
+void temp_tick(void *userdata) {
 	uint8_t i = 0;
 	for (; i < temp_sensors_count; i++) {
 		if (temp_sensors_runtime[i].next_read_time) {
@@ -43,32 +54,57 @@ void temp_tick() {
 		//time to deal with this temp sensor
 		
 		temp_sensors[i].sensor_read(&temp_sensors[i], &temp_sensors_runtime[i]);
+
+		if (temp_sensors_offset[i]) {
+			int16_t t = temp_sensors_runtime[i].last_read_temp + temp_sensors_offset[i];
+			temp_sensors_runtime[i].last_read_temp = (t < 0) ? 0 : t;
+		}
 		
+		// residency is counted in 10ms ticks, slow sensors cover more than one tick per reading
 		if (labs((int16_t)(temp_sensors_runtime[i].last_read_temp - temp_sensors_runtime[i].target_temp)) < (TEMP_HYSTERESIS*4)) {
-			if (temp_sensors_runtime[i].temp_residency < (TEMP_RESIDENCY_TIME*100))
-				temp_sensors_runtime[i].temp_residency++;
+			temp_sensors_runtime[i].temp_residency += temp_sensors_runtime[i].next_read_time + 1;
+			if (temp_sensors_runtime[i].temp_residency > (TEMP_RESIDENCY_TIME*100))
+				temp_sensors_runtime[i].temp_residency = (TEMP_RESIDENCY_TIME*100);
 		}
 		else {
 			temp_sensors_runtime[i].temp_residency = 0;
 		}
 
-		//if (temp_sensors[i].heater < NUM_HEATERS) {
-		//	heater_tick(temp_sensors[i].heater/*, temp_sensors[i].temp_type*/, temp_sensors_runtime[i].last_read_temp, temp_sensors_runtime[i].target_temp);
-		//}
+		if (i < 8) {
+			if (temp_sensors_runtime[i].target_temp == 0 || temp_sensors_runtime[i].temp_residency >= (TEMP_RESIDENCY_TIME*100))
+				temp_achieved_mask |= MASK(i);
+			else
+				temp_achieved_mask &= ~MASK(i);
+		}
+
+		if (temp_sensors[i].heater != TEMP_NO_HEATER)
+			heater_tick(temp_sensors[i].heater, temp_sensors_runtime[i].last_read_temp, temp_sensors_runtime[i].target_temp);
 	}
 }
 
-/// report whether all temp sensors are reading their target temperatures
-/// used for M109 and friends
+/// report whether all temp sensors are reading their target temperatures. Sensors without target don't count.
+/// used for M116 and friends
 uint8_t	temp_achieved() {
-	uint8_t i;
-	uint8_t all_ok = 255;
+	return temp_wait(255);
+}
 
-	for (i = 0; i < temp_sensors_count; i++) {
-		if (temp_sensors_runtime[i].temp_residency < (TEMP_RESIDENCY_TIME*100))
-			all_ok = 0;
-	}
-	return all_ok;
+/** \brief wait token condition for M109, M190 and M116
+	\param index sensor to check, 255 - all sensors
+	\return 255 if the sensor(s) reached target, 0 otherwise
+
+	Polled from the step interrupt, see axes_wait().
+*/
+uint8_t temp_wait(uint8_t index) {
+	uint8_t mask;
+
+	if (index == 255)
+		mask = (temp_sensors_count >= 8) ? 0xFF : (MASK(temp_sensors_count) - 1);
+	else if (index < temp_sensors_count && index < 8)
+		mask = MASK(index);
+	else
+		return 255;
+
+	return ((temp_achieved_mask & mask) == mask) ? 255 : 0;
 }
 
 /// specify a target temperature
@@ -82,6 +118,12 @@ void temp_set(uint8_t index, uint16_t temperature) {
 	if (temp_sensors_runtime[index].target_temp != temperature) {
 		temp_sensors_runtime[index].target_temp = temperature;
 		temp_sensors_runtime[index].temp_residency = 0;
+		if (index < 8) {
+			if (temperature)
+				temp_achieved_mask &= ~MASK(index);
+			else
+				temp_achieved_mask |= MASK(index);
+		}
 	}
 }
 
@@ -109,6 +151,168 @@ void temp_print() {
 		);
 	}
 }
+/// find first sensor with given M105 character
+/// \param rep_char character to look for
+/// \return sensor index or temp_sensors_count if there is no such sensor
+uint8_t temp_lookup(uint8_t rep_char) {
+	uint8_t i;
+
+	for (i = 0; i < temp_sensors_count; i++) {
+		if (temp_sensors[i].rep_char == rep_char)
+			break;
+	}
+	return i;
+}
+
+/// make M104 and M109 without P ask extruder which sensor they're for, e.g. the current tool's
+void temp_set_extruder(temp_extruder_func extruder) {
+	temp_extruder = extruder;
+}
+
+/// sensor M104 and M109 address
+static uint8_t temp_lookup_extruder(void *next_target) {
+	if (PARAMETER_SEEN(L_P))
+		return PARAMETER_asint(L_P);
+	return temp_extruder ? temp_extruder(next_target) : temp_lookup('T');
+}
+
+void temp_gcode_process(void *next_target) {
+	uint8_t                index;
+	
+	if(! PARAMETER_SEEN(L_M))
+		return;
+	
+	switch(PARAMETER_asint(L_M)){
+		case 104:
+			//? --- M104: Set Extruder Temperature (Fast) ---
+			//?
+			//? Example: M104 S190
+			//?
+			//? Set the temperature of the current extruder to 190<sup>o</sup>C and return control to the host immediately (''i.e.'' before that temperature has been reached by the extruder).  See also M109.
+			//? Teacup supports an optional P parameter as a sensor index to address (eg M104 P1 S100 will set the bed temperature rather than the extruder temperature).
+			//? With tool changing, T addresses the heater of that tool instead of the current one (eg M104 T1 S170), see M568.
+			//?
+			if(! PARAMETER_SEEN(L_S))
+				break;
+			
+			index = temp_lookup_extruder(next_target);
+			
+			// temperatures are stored as 14.2 fixed point
+			temp_set(index, PARAMETER_asmult(L_S, 4));
+			if (PARAMETER_asint(L_S))
+				power_on();
+			break;
+			
+		case 109:
+			//? --- M109: Set Extruder Temperature and Wait ---
+			//?
+			//? Example: M109 S190
+			//?
+			//? Set the temperature of the current extruder to 190<sup>o</sup>C, then hold back further moves until it stayed within TEMP_HYSTERESIS of that for TEMP_RESIDENCY_TIME seconds.
+			//? The wait is queued behind moves already given, and commands are acknowledged meanwhile, so homing or other non-moving commands overlap with heating. Without S, just wait.
+			//? Teacup supports an optional P parameter as a sensor index to address.
+			//?
+			index = temp_lookup_extruder(next_target);
+
+			if (PARAMETER_SEEN(L_S)) {
+				temp_set(index, PARAMETER_asmult(L_S, 4));
+				if (PARAMETER_asint(L_S))
+					power_on();
+			}
+			axes_wait(&temp_wait, index, 0);
+			break;
+
+		case 105:
+			//? --- M105: Get Extruder Temperature ---
+			//?
+			//? Example: M105
+			//?
+			//? Request the temperature of the current extruder and the build base in degrees Celsius.  The temperatures are returned to the host computer.  For example, the line sent to the host in response to this command looks like
+			//?
+			//? <tt>ok T:201 B:117</tt>
+			//?
+			temp_print();
+			break;
+			
+		case 140:
+			//? --- M140: Set heated bed temperature ---
+			//?
+			//? Example: M140 S55
+			//?
+			//? Set the temperature of the sensor reported as 'B' in M105.
+			//?
+			if(! PARAMETER_SEEN(L_S))
+				break;
+			
+			temp_set(temp_lookup('B'), PARAMETER_asmult(L_S, 4));
+			if (PARAMETER_asint(L_S))
+				power_on();
+			break;
+
+		case 190:
+			//? --- M190: Set Bed Temperature and Wait ---
+			//?
+			//? Example: M190 S60
+			//?
+			//? Like M109, for the sensor reported as 'B' in M105.
+			//?
+			index = temp_lookup('B');
+
+			if (PARAMETER_SEEN(L_S)) {
+				temp_set(index, PARAMETER_asmult(L_S, 4));
+				if (PARAMETER_asint(L_S))
+					power_on();
+			}
+			axes_wait(&temp_wait, index, 0);
+			break;
+
+		case 116:
+			//? --- M116: Wait ---
+			//?
+			//? Example: M116
+			//?
+			//? Hold back further moves until all temperatures arrived at their targets. See also M109.
+			//?
+			axes_wait(&temp_wait, 255, 0);
+			break;
+
+		case 308:
+			//? --- M308: set temperature sensor offset ---
+			//?
+			//? Example: M308 P0 S-2.5
+			//?
+			//? Add S<sup>o</sup>C to every reading of sensor P, to calibrate it against a reference thermometer. Save with M500.
+			//?
+			index = PARAMETER_SEEN(L_P) ? PARAMETER_asint(L_P) : temp_lookup('T');
+			if (PARAMETER_SEEN(L_S) && index < temp_sensors_count)
+				temp_sensors_offset[index] = PARAMETER_asmult(L_S, 4);
+			break;
+	}
+}
+
+/// after an emergency stop, temperatures tell whether the heaters really went off
+static void temp_emergency_report(void *data) {
+	temp_print();
+}
+
+/// set up sensors and register the control loop
+void temp_init(void) {
+	uint8_t i;
+
+	for (i = 0; i < temp_sensors_count; i++) {
+		temp_sensors[i].sensor_setup(&temp_sensors[i]);
+		
+		// spread first readings of all sensors over the first ticks
+		temp_sensors_runtime[i].next_read_time = i;
+	}
+
+	settings_register(temp_sensors_offset, sizeof(temp_sensors_offset[0]) * temp_sensors_count, 0);
+
+	core_register(EVENT_TICK_10MS,     &temp_tick);
+	core_register(EVENT_GCODE_PROCESS,    &temp_gcode_process);
+	core_register(EVENT_EMERGENCY_REPORT, &temp_emergency_report);
+}
+
 /* FIXME temperature conversion from gcode
 				case 'S':
 					// if this is temperature, multiply by 4 to convert to quarter-degree units
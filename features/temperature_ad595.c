@@ -3,12 +3,18 @@
 #ifndef FEATURES_H
 API typedef struct sensor_ad595_userdata { uint8_t pin; } sensor_ad595_userdata;
 API void ad595_init(void);
+API void ad595_setup(const temp_sensor_t *sensor);
 API void ad595_read(const temp_sensor_t *sensor, temp_sensor_runtime_t *runtime);
 #endif
 
 void ad595_init(void){
 	// initialised when read
 }
+void ad595_setup(const temp_sensor_t *sensor){
+	sensor_ad595_userdata *userdata = sensor->userdata;
+	
+	analog_usepin(userdata->pin);
+}
 void ad595_read(const temp_sensor_t *sensor, temp_sensor_runtime_t *runtime){
 	uint16_t               temp     = 0;
 	sensor_ad595_userdata *userdata = sensor->userdata;
@@ -3,11 +3,15 @@
 #ifndef FEATURES_H
 API typedef struct sensor_dummy_userdata { } sensor_dummy_userdata;
 API void dummy_init(void);
+API void dummy_setup(const temp_sensor_t *sensor);
 API void dummy_read(const temp_sensor_t *sensor, temp_sensor_runtime_t *runtime);
 #endif
 
 void dummy_init(void){
 	
+}
+void dummy_setup(const temp_sensor_t *sensor){
+	
 }
 void dummy_read(const temp_sensor_t *sensor, temp_sensor_runtime_t *runtime){
 	uint16_t	temp = 0;
@@ -20,4 +24,5 @@ void dummy_read(const temp_sensor_t *sensor, temp_sensor_runtime_t *runtime){
 		temp--;
 
 	runtime->next_read_time = 0;
+	runtime->last_read_temp = temp;
 }
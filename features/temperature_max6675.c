@@ -3,6 +3,7 @@
 #ifndef FEATURES_H
 API typedef struct sensor_max6675_userdata { } sensor_max6675_userdata;
 API void max6675_init(void);
+API void max6675_setup(const temp_sensor_t *sensor);
 API void max6675_read(const temp_sensor_t *sensor, temp_sensor_runtime_t *runtime);
 #endif
 
@@ -13,6 +14,9 @@ void max6675_init(void){
 	WRITE(MOSI, 1);				SET_OUTPUT(MOSI);
 	WRITE(MISO, 1);				SET_INPUT(MISO);
 	WRITE(SS, 1);				SET_OUTPUT(SS);*/
+}
+void max6675_setup(const temp_sensor_t *sensor){
+	
 }
 void max6675_read(const temp_sensor_t *sensor, temp_sensor_runtime_t *runtime){
 	uint16_t	temp = 0;
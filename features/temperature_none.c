@@ -3,11 +3,15 @@
 #ifndef FEATURES_H
 API typedef struct sensor_none_userdata { } sensor_none_userdata;
 API void none_init(void);
+API void none_setup(const temp_sensor_t *sensor);
 API void none_read(const temp_sensor_t *sensor, temp_sensor_runtime_t *runtime);
 #endif
 
 void none_init(void){
 	
+}
+void none_setup(const temp_sensor_t *sensor){
+	
 }
 void none_read(const temp_sensor_t *sensor, temp_sensor_runtime_t *runtime){
 	runtime->last_read_temp = runtime->target_temp; // for get_temp()
@@ -4,11 +4,17 @@
 #ifndef FEATURES_H
 API typedef struct sensor_thermistor_userdata { uint8_t pin; uint8_t table_num; } sensor_thermistor_userdata;
 API void thermistor_init(void);
+API void thermistor_setup(const temp_sensor_t *sensor);
 API void thermistor_read(const temp_sensor_t *sensor, temp_sensor_runtime_t *runtime);
 #endif
 
 void thermistor_init(void){
 	
+}
+void thermistor_setup(const temp_sensor_t *sensor){
+	sensor_thermistor_userdata  *userdata = sensor->userdata;
+	
+	analog_usepin(userdata->pin);
 }
 void thermistor_read(const temp_sensor_t *sensor, temp_sensor_runtime_t *runtime){
 	uint8_t                      j, table_num;
@@ -55,13 +61,13 @@ void thermistor_read(const temp_sensor_t *sensor, temp_sensor_runtime_t *runtime
 			//if (DEBUG_PID && (debug_flags & DEBUG_PID))
 			//	sersendf_P(PSTR(" temp:%d.%d"),temp/4,(temp%4)*25);
 			//#endif
-			return;
+			break;
 		}
 	}
 	
 	//Clamp for overflows
 	if (j == NUMTEMPS)
-		temp = temptable[table_num][NUMTEMPS-1][1];
+		temp = pgm_read_word(&(temptable[table_num][NUMTEMPS-1][1]));
 
 	runtime->next_read_time = 0;
 	runtime->last_read_temp = temp;
@@ -12,17 +12,24 @@ void time_gcode_process(void *next_target){
 				//? Example: G4 P200
 				//?
 				//? In this case sit still doing nothing for 200 milliseconds.  During delays the state of the machine (for example the temperatures of its extruders) will still be preserved and controlled.
+				//? Teacup accepts S for seconds as well. The dwell is queued like a move, so commands are still read while the axes pause.
+				//? It starts once all axes finished their moves.
 				//?
 				
-				M400_WAIT();
-				// delay
-				if (PARAMETER_SEEN(L_P)) {
+				if (PARAMETER_SEEN(L_P) || PARAMETER_SEEN(L_S)) {
 					int32_t delay_time;
 					
-					for (delay_time = PARAMETER_asint(L_P); delay_time > 0; delay_time--){
-						core_emit(EVENT_TICK, 0);
-						_delay_ms(1);
+					delay_time = PARAMETER_SEEN(L_P) ? PARAMETER_asint(L_P) : PARAMETER_asmult(L_S, 1000);
+					
+					axes_barrier(0, 0);
+					
+					// a dwell longer than a minute could overflow CPU ticks, queue it in pieces
+					while (delay_time > 60000) {
+						axes_wait(0, 0, 60000 MS);
+						delay_time -= 60000;
 					}
+					if (delay_time > 0)
+						axes_wait(0, 0, delay_time MS);
 				}
 				break;
 		}
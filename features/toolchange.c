@@ -1,36 +1,269 @@
-#define FEATURE
 #include "common.h"
+#include "axes.h"
+#include "pinio.h"
+
+// CONFIGURATION
+#define TOOLCHANGE_TOOLS       2               ///< number of tools
+#define TOOLCHANGE_SENSORS     { 0, 0 }        ///< temperature sensor of each tool's heater, index in config_temperature.c
+#define TOOLCHANGE_EXTRUDERS   { L_E, L_E }    ///< letter of each tool's extruder motor in config_axes.c, e.g. { L_E, L_U }. Tool 0 has L_E
+#define TOOLCHANGE_STANDBY     150             ///< degrees C an idle tool is kept at, 0 - off. Change with M568 R
+#define TOOLCHANGE_ADVANCE_MAX 2000000         ///< us, largest pressure advance M900 accepts
+// END OF CONFIGURATION
 
 API void toolchange_init(void);
 
+/** \file
+	\brief Tools: nozzle offsets, heaters, extruder motors and the change between them
+
+	T picks the next tool, M6 changes to it. Each tool has its own temperature sensor and
+	extruder motor, tools may share them.
+
+	Offsets of the current tool are added to absolute X, Y and Z in axis_gcode_universal(), so
+	position_curr stays in machine coordinates. A new offset applies from the next absolute move
+	on, nothing moves on M6 itself.
+
+	The extruder motor of the current tool answers E. On M6 it swaps letters with the one of the
+	new tool, which takes over the E position, the relative and inch modes and the M221 flow,
+	after the queues ran empty. Idle motors are still there under their own letter, e.g. for M92.
+
+	Temperatures set with M104, M109 or M568 S are remembered per tool. M6 drops the old tool to
+	its standby temperature and queues a wait for the new one, moves continue once it's hot. T
+	already heats the next tool up from standby, so with a few moves between T and M6 there's
+	little or nothing left to wait for.
+*/
+
+typedef struct toolchange_settings_t {
+	 int32_t               offset[3];              ///< X, Y and Z offset (um), M218
+	uint32_t               advance;                ///< pressure advance (us), M900
+	uint16_t               standby;                ///< temperature while idle, 14.2 fixed point, M568 R
+} toolchange_settings_t;
+
 uint8_t tool;      ///< the current tool
 uint8_t next_tool; ///< the tool to be changed when we get an M6
 
+/// saved by M500
+static toolchange_settings_t toolchange[TOOLCHANGE_TOOLS];
+
+static const uint8_t   toolchange_sensors[TOOLCHANGE_TOOLS]   = TOOLCHANGE_SENSORS;
+static const uint8_t   toolchange_letters[TOOLCHANGE_TOOLS]   = TOOLCHANGE_EXTRUDERS;
+
+/// extruder motor of each tool, 0 if config_axes.c has none
+static axis_t         *toolchange_extruders[TOOLCHANGE_TOOLS];
+
+/// temperature of each tool while in use, 14.2 fixed point, 0 - never set
+static uint16_t        toolchange_active[TOOLCHANGE_TOOLS];
+
+static void toolchange_defaults(void){
+	uint8_t                i;
+
+	for(i = 0; i < TOOLCHANGE_TOOLS; i++){
+		toolchange[i].offset[0] = 0;
+		toolchange[i].offset[1] = 0;
+		toolchange[i].offset[2] = 0;
+		toolchange[i].advance   = 0;
+		toolchange[i].standby   = TOOLCHANGE_STANDBY * 4;
+	}
+}
+
+/// make the axes use offsets and pressure advance of the current tool
+static void toolchange_apply(void){
+	static const uint8_t   letters[3]        = { L_X, L_Y, L_Z };
+	axis_t                *axis;
+	uint8_t                i;
+
+	for(i = 0; i < 3; i++){
+		axis = axes_find(letters[i]);
+		if(axis)
+			axis->runtime.offset = &toolchange[tool].offset[i];
+	}
+
+	axis = axes_find(L_E);
+	if(axis)
+		axis->runtime.advance = &toolchange[tool].advance;
+}
+
+/// make motor to answer E instead of from, the queues are empty
+static void toolchange_extruder(axis_t *from, axis_t *to){
+	uint8_t                letter;
+
+	if(!from || !to || from == to)
+		return;
+
+	letter     = to->letter;
+	to->letter = from->letter;
+	from->letter = letter;
+
+	to->runtime.relative       = from->runtime.relative;
+	to->runtime.inches         = from->runtime.inches;
+	to->runtime.flow           = from->runtime.flow;
+	to->runtime.position_curr  = from->runtime.position_curr;
+	to->runtime.position_motor = from->runtime.position_curr;
+	if(to->proto->func_set_position)
+		to->proto->func_set_position(to);
+}
+
+/// heat tool t up from standby, unless it's the current one or shares its heater
+static void toolchange_preheat(uint8_t t){
+	if(t == tool || !toolchange_active[t] || toolchange_sensors[t] == toolchange_sensors[tool])
+		return;
+
+	temp_set(toolchange_sensors[t], toolchange_active[t]);
+	power_on();
+}
+
+/// M6, change to next_tool
+static void toolchange_change(void){
+	uint8_t                old               = tool;
+
+	// motors and offsets change between moves, not during one
+	axes_barrier_wait();
+
+	toolchange_extruder(toolchange_extruders[old], toolchange_extruders[next_tool]);
+	tool = next_tool;
+	toolchange_apply();
+
+	if(toolchange_sensors[old] == toolchange_sensors[tool])
+		return;
+
+	if(toolchange_active[old])
+		temp_set(toolchange_sensors[old], toolchange[old].standby);
+	if(toolchange_active[tool]){
+		temp_set(toolchange_sensors[tool], toolchange_active[tool]);
+		power_on();
+		axes_wait(&temp_wait, toolchange_sensors[tool], 0);
+	}
+}
+
+/// sensor of the tool M104 and M109 address, T or the current one
+static uint8_t toolchange_sensor(void *next_target){
+	uint8_t                t                 = PARAMETER_SEEN(L_T) ? PARAMETER_asint(L_T) : tool;
+
+	return toolchange_sensors[t < TOOLCHANGE_TOOLS ? t : tool];
+}
+
 void toolchange_gcode_process(void *next_target){
-	
-	if(PARAMETER_SEEN(L_T)) {
+	uint8_t                t;
+	uint8_t                i;
+
+	// with any other M, T is the tool to configure
+	if(PARAMETER_SEEN(L_T) && (!PARAMETER_SEEN(L_M) || PARAMETER_asint(L_M) == 6)) {
 		//? --- T: Select Tool ---
 		//?
 		//? Example: T1
 		//?
-		//? Select extruder number 1 to build with.  Extruder numbering starts at 0.
-		
-		next_tool = PARAMETER_asint(L_T);
+		//? Select extruder number 1 to build with.  Extruder numbering starts at 0. The change
+		//? happens with M6, meanwhile the tool heats up from its standby temperature.
+
+		t = PARAMETER_asint(L_T);
+		if(t < TOOLCHANGE_TOOLS){
+			next_tool = t;
+			toolchange_preheat(t);
+		}
 	}
-	
+
 	if(PARAMETER_SEEN(L_M)) {
+		t = PARAMETER_SEEN(L_T) ? PARAMETER_asint(L_T) : tool;
+		if(t >= TOOLCHANGE_TOOLS)
+			return;
+
 		switch(PARAMETER_asint(L_M)){
 			case 6:
 				//? --- M6: tool change ---
 				//?
-				//? Undocumented.
-				tool = next_tool;
+				//? Example: M6 T1
+				//?
+				//? Change to the tool selected with T. Waits for the moves queued before, then the new
+				//? tool's offsets and extruder motor apply. The old tool drops to its standby
+				//? temperature, moves wait for the new one to be at its temperature.
+				//?
+				toolchange_change();
+				break;
+
+			case 104:
+			case 109:
+				// temperature.c set it, remember it for tool changes
+				if(PARAMETER_SEEN(L_S) && !PARAMETER_SEEN(L_P))
+					toolchange_active[t] = PARAMETER_asmult(L_S, 4);
+				break;
+
+			case 218:
+				//? --- M218: set tool offset ---
+				//?
+				//? Example: M218 T1 X20 Y0.5 Z-0.1
+				//?
+				//? Set the offset in mm of the nozzle of tool T to the one of tool 0, the current tool
+				//? without T. Absolute moves add it to their coordinates. Without X, Y and Z the
+				//? offsets are reported. Save with M500.
+				//?
+				if(PARAMETER_SEEN(L_X))
+					toolchange[t].offset[0] = PARAMETER_asmult(L_X, 1000);
+				if(PARAMETER_SEEN(L_Y))
+					toolchange[t].offset[1] = PARAMETER_asmult(L_Y, 1000);
+				if(PARAMETER_SEEN(L_Z))
+					toolchange[t].offset[2] = PARAMETER_asmult(L_Z, 1000);
+				if(!PARAMETER_SEEN(L_X) && !PARAMETER_SEEN(L_Y) && !PARAMETER_SEEN(L_Z)){
+					sersendf_P(PSTR("T%u"), t);
+					for(i = 0; i < 3; i++)
+						sersendf_P(PSTR(" %c:%lq"), gcode_convert_letter((letters)(L_X + i)), toolchange[t].offset[i]);
+					serial_writechar(' ');
+				}
+				break;
+
+			case 568:
+				//? --- M568: set tool temperatures ---
+				//?
+				//? Example: M568 T1 S210 R160
+				//?
+				//? Set the temperature tool T heats to while in use and the one it's kept at while idle,
+				//? R0 turns it off then. For the current tool without T. S of the current tool applies
+				//? at once, standby with the next tool change. Without S and R they're reported. Save
+				//? standby with M500.
+				//?
+				if(PARAMETER_SEEN(L_S)){
+					toolchange_active[t] = PARAMETER_asmult(L_S, 4);
+					if(t == tool){
+						temp_set(toolchange_sensors[t], toolchange_active[t]);
+						if(toolchange_active[t])
+							power_on();
+					}
+				}
+				if(PARAMETER_SEEN(L_R))
+					toolchange[t].standby = PARAMETER_asmult(L_R, 4);
+				if(!PARAMETER_SEEN(L_S) && !PARAMETER_SEEN(L_R))
+					sersendf_P(PSTR("T%u S%u R%u "), t, toolchange_active[t] / 4, toolchange[t].standby / 4);
+				break;
+
+			case 900:
+				//? --- M900: set pressure advance ---
+				//?
+				//? Example: M900 K0.05 T1
+				//?
+				//? Set the time in seconds the extruder runs ahead of its moves, to make up for filament
+				//? compressing in the nozzle as extrusion speeds up. The extruder then pushes K times
+				//? its speed more, and less again when slowing down. For tool T, the current tool without
+				//? T. K0 turns it off, without K the setting is reported. Save with M500.
+				//?
+				if(PARAMETER_SEEN(L_K))
+					toolchange[t].advance = constrain(PARAMETER_asmult(L_K, 10000) * 100, 0, TOOLCHANGE_ADVANCE_MAX);
+				else
+					sersendf_P(PSTR("T%u K:%lq "), t, toolchange[t].advance / 1000);
 				break;
 		}
 	}
 }
 
 void toolchange_init(void){
+	uint8_t                i;
+
+	for(i = 0; i < TOOLCHANGE_TOOLS; i++)
+		toolchange_extruders[i] = axes_find(toolchange_letters[i]);
+
+	// saved offsets and temperatures replace these in settings_init()
+	toolchange_defaults();
+	settings_register(toolchange, sizeof(toolchange), &toolchange_defaults);
+
+	toolchange_apply();
+
+	temp_set_extruder(&toolchange_sensor);
 	core_register(EVENT_GCODE_PROCESS, &toolchange_gcode_process);
 }
-
@@ -36,8 +36,10 @@ typedef enum parser_state {
 /// crude crc macro
 #define crc(a, b)		(a ^ b)
 
-/// crude floating point data storage
-decfloat      read_digit					__attribute__ ((__section__ (".bss")));
+/// number being read, converted into a decfloat once complete
+uint32_t      read_mantissa                    __attribute__ ((__section__ (".bss")));
+uint8_t       read_exponent                    __attribute__ ((__section__ (".bss"))); ///< 0 before the decimal point, then 1 + digits after it
+uint8_t       read_sign                        __attribute__ ((__section__ (".bss")));
 
 /// this is where we store all the data for the current command before we work out what to do with it
 GCODE_COMMAND next_gcode		__attribute__ ((__section__ (".bss")));
@@ -45,6 +47,40 @@ GCODE_COMMAND next_gcode		__attribute__ ((__section__ (".bss")));
 parser_state  gcode_parser_state       = S_PARSE_CHAR;
 uint8_t       gcode_parser_char        = MAX_LETTER;
 
+/// value of sparse letters not seen in a command
+static decfloat gcode_unseen            __attribute__ ((__section__ (".bss")));
+/// sink for sparse letters beyond GCODE_SPARSE
+static decfloat gcode_discard           __attribute__ ((__section__ (".bss")));
+
+/** \brief find the slot of a sparse letter
+	\param create allocate a slot and mark the letter seen if it has none yet
+
+	A slot belongs to its letter as long as that letter is seen, so clearing seen frees all of
+	them. Unseen letters read as zero, letters beyond GCODE_SPARSE are dropped.
+*/
+decfloat    *gcode_sparse(GCODE_COMMAND *gcode, letters letter, uint8_t create){
+	uint8_t                i, l, slot = GCODE_SPARSE;
+
+	for(i = 0; i < GCODE_SPARSE; i++){
+		l = gcode->sparse_letter[i];
+		if(l >= L_SPARSE && l < MAX_LETTER && (gcode->seen & (1UL << l))){
+			if(l == letter)
+				return &gcode->sparse[i];
+		}else if(slot == GCODE_SPARSE){
+			slot = i;
+		}
+	}
+	if(!create)
+		return &gcode_unseen;
+	if(slot == GCODE_SPARSE)
+		return &gcode_discard;
+
+	gcode->sparse_letter[slot] = letter;
+	gcode->sparse[slot].value = gcode->sparse[slot].asint = 0;
+	gcode->seen |= 1UL << letter;
+	return &gcode->sparse[slot];
+}
+
 lexer_token  gcode_lexer(uint8_t c){
 	      if(c >= 'A' && c <= 'Z'){      return T_CHAR;
 	}else if(c == '*'){                  return T_CHAR;
@@ -74,6 +110,21 @@ letters      gcode_convert_char(uint8_t c){
 		case 'T': return L_T;
 		case 'N': return L_N;
 		case '*': return L_CHECKSUM;
+		case 'A': return L_A;
+		case 'B': return L_B;
+		case 'C': return L_C;
+		case 'D': return L_D;
+		case 'H': return L_H;
+		case 'I': return L_I;
+		case 'J': return L_J;
+		case 'K': return L_K;
+		case 'L': return L_L;
+		case 'O': return L_O;
+		case 'Q': return L_Q;
+		case 'R': return L_R;
+		case 'U': return L_U;
+		case 'V': return L_V;
+		case 'W': return L_W;
 	}
 	return MAX_LETTER;
 }
@@ -92,6 +143,21 @@ uint8_t      gcode_convert_letter(letters c){
 		case L_T: return 'T';
 		case L_N: return 'N';
 		case L_CHECKSUM: return '*';
+		case L_A: return 'A';
+		case L_B: return 'B';
+		case L_C: return 'C';
+		case L_D: return 'D';
+		case L_H: return 'H';
+		case L_I: return 'I';
+		case L_J: return 'J';
+		case L_K: return 'K';
+		case L_L: return 'L';
+		case L_O: return 'O';
+		case L_Q: return 'Q';
+		case L_R: return 'R';
+		case L_U: return 'U';
+		case L_V: return 'V';
+		case L_W: return 'W';
 		case MAX_LETTER:
 			break;
 	}
@@ -139,13 +205,19 @@ redo:;
 				case T_CHAR:
 					if( (gcode_parser_char = gcode_convert_char(c)) == MAX_LETTER)
 						goto error; // unknown parameter letter
-					gcode_parser_state = S_PARSE_NUMBER;
 					
-					// clean read_digit before parsing anything
-					read_digit.sign = read_digit.mantissa = read_digit.exponent = 0;
+					// set seen flag, sparse letters get their slot now
+					if(gcode_parser_char < L_SPARSE){
+						next_gcode.seen |= 1UL << gcode_parser_char;
+					}else if(gcode_sparse(&next_gcode, gcode_parser_char, 1) == &gcode_discard){
+						gcode_parser_char = MAX_LETTER;
+						goto error; // too many sparse parameters
+					}
+					gcode_parser_state = S_PARSE_NUMBER;
 					
-					// set seen flag
-					next_gcode.seen |= 1 << gcode_parser_char;
+					// clean the number before parsing anything
+					read_sign = read_exponent = 0;
+					read_mantissa = 0;
 					break;
 				
 				// ignore spaces
@@ -181,30 +253,26 @@ redo:;
 		case S_PARSE_NUMBER: // wait for parameter value mode
 			switch(type){
 				case T_DIGIT:
-					if (read_digit.exponent < DECFLOAT_EXP_MAX + 1){
-						// this is simply mantissa = (mantissa * 10) + atoi(c) in different clothes
-						read_digit.mantissa = (read_digit.mantissa << 3) + (read_digit.mantissa << 1) + (c - '0');
-						if (read_digit.exponent)
-							read_digit.exponent++;
-					}
+					decfloat_add_digit(&read_mantissa, &read_exponent, c - '0');
 					break;
 					
 				case T_SIGN:
-					read_digit.sign     = 1;
+					read_sign     = 1;
 					// force sign to be at start of number, so 1-2 = -2 instead of -12
-					read_digit.exponent = 0;
-					read_digit.mantissa = 0;
+					read_exponent = 0;
+					read_mantissa = 0;
 					break;
 
 				case T_DOT:
-					if (read_digit.exponent == 0)
-						read_digit.exponent = 1;
+					if (read_exponent == 0)
+						read_exponent = 1;
 					break;
 					
 				case T_NEWLINE: // we finished
 				case T_SPACE:   
 					// since we use universal parameters table - all conversions to inch or mm goes to according modules
-					next_gcode.parameters[gcode_parser_char] = read_digit;
+					// converting once here saves every handler looking at it from doing it again
+					decfloat_set_digits(GCODE_PARAMETER(&next_gcode, gcode_parser_char, 1), read_mantissa, read_exponent, read_sign);
 					
 					gcode_parser_state = S_PARSE_CHAR;
 					gcode_parser_char  = MAX_LETTER;
@@ -11,6 +11,7 @@
 //#define	REQUIRE_CHECKSUM
 
 typedef enum letters { ///< This enum is used to reduce size of arrays which use letters as index
+	// letters with a fixed place in GCODE_COMMAND.parameters[], keep them modal
 	L_G,
 	L_M,
 	L_X,
@@ -26,23 +27,56 @@ typedef enum letters { ///< This enum is used to reduce size of arrays which use
 	L_N,
 	L_CHECKSUM,
 	
-	MAX_LETTER
+	// letters sharing the GCODE_SPARSE slots, only valid for the line they were seen in
+	L_A,
+	L_B,
+	L_C,
+	L_D,
+	
+	L_H,
+	L_I,
+	L_J,
+	L_K,
+	
+	L_L,
+	L_O,
+	L_Q,
+	L_R,
+	
+	L_U,
+	L_V,
+	L_W,
+	
+	MAX_LETTER,
+	L_SPARSE = L_A
 } letters;
 
+/// number of sparse letters one command can hold
+#define	GCODE_SPARSE           6
+
 /// this holds all the possible data from a received command
 typedef struct {
 	uint8_t                checksum;                 ///< checksum we calculated
-	uint16_t               seen;                     ///< bit field for parameters
-	decfloat               parameters[MAX_LETTER];   ///< array with all parameters
+	uint32_t               seen;                     ///< bit field for parameters
+	decfloat               parameters[L_SPARSE];     ///< array with frequent parameters
+	uint8_t                sparse_letter[GCODE_SPARSE]; ///< letter held by each sparse slot, valid while its seen bit is set
+	decfloat               sparse[GCODE_SPARSE];     ///< values of the less frequent parameters
 } GCODE_COMMAND;
 
-#define PARAMETER_asint(_letter)        ( decfloat_to_int( &(((GCODE_COMMAND *) next_target)->parameters[_letter]), 1) )
-#define PARAMETER_asmult(_letter,_mult) ( decfloat_to_int( &(((GCODE_COMMAND *) next_target)->parameters[_letter]), _mult) )
-#define PARAMETER_SEEN(_letter)         ( (((GCODE_COMMAND *)next_target)->seen & (1<<_letter)) != 0 )
+decfloat    *gcode_sparse(GCODE_COMMAND *gcode, letters letter, uint8_t create);
+
+/// parameter storage of a letter, folds to a plain array access for constant frequent letters
+#define GCODE_PARAMETER(gcode,_letter,create) ( ((_letter) < L_SPARSE) ?       \
+	&(((GCODE_COMMAND *)(gcode))->parameters[(_letter) < L_SPARSE ? (_letter) : 0]) : \
+	gcode_sparse((GCODE_COMMAND *)(gcode), (_letter), create) )
+
+#define PARAMETER_asint(_letter)        ( decfloat_to_int( GCODE_PARAMETER(next_target, _letter, 0), 1) )
+#define PARAMETER_asmult(_letter,_mult) ( decfloat_to_int( GCODE_PARAMETER(next_target, _letter, 0), _mult) )
+#define PARAMETER_SEEN(_letter)         ( (((GCODE_COMMAND *)next_target)->seen & (1UL<<(_letter))) != 0 )
 #define PARAMETER_SET(gcode,letter,value)    do {                         \
 	decfloat_set_int(                                                 \
-		&( ((GCODE_COMMAND *)gcode)->parameters[letter]), value); \
-		((GCODE_COMMAND *)gcode)->seen |= (1<<letter);            \
+		GCODE_PARAMETER(gcode, letter, 1), value);                \
+		((GCODE_COMMAND *)gcode)->seen |= (1UL<<(letter));        \
 	} while(0);
 
 void gcode_init(void);
@@ -53,6 +87,6 @@ void gcode_parse_char(uint8_t c);
 uint8_t      gcode_convert_letter(letters c);
 letters      gcode_convert_char(uint8_t c);
 				
-#define M400_WAIT() do { GCODE_COMMAND wait; PARAMETER_SET(&wait, L_M, 400); core_emit(EVENT_GCODE_PROCESS, &wait); } while(0);
+#define M400_WAIT() do { GCODE_COMMAND wait; wait.seen = 0; PARAMETER_SET(&wait, L_M, 400); core_emit(EVENT_GCODE_PROCESS, &wait); } while(0);
 
 #endif	/* _GCODE_PARSE_H */
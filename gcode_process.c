@@ -2,6 +2,7 @@
 	\brief Work out what to do with received G-Code commands
 */
 #include	"common.h"
+#include	"dda_maths.h"
 
 /***************************************************************************\
 *                                                                           *
@@ -19,6 +20,39 @@ void request_resend(void *next_target) {
 
 uint32_t N_expected;
 
+#ifdef	DEBUG
+/// print CPU cycles one evaluation of expr takes, timer 1 counts them unscaled
+#define	MATHS_BENCH(name, expr) do {                                     \
+		uint16_t               cycles;                                     \
+		                                                                   \
+		cli();                                                             \
+		cycles = TCNT1;                                                    \
+		result = (expr);                                                   \
+		cycles = TCNT1 - cycles;                                           \
+		sei();                                                             \
+		sersendf_P(PSTR(name ":%u "), cycles);                             \
+	} while (0)
+
+/// cycle counts of the dda maths routines, operands are volatile so nothing gets folded at compile time
+void maths_benchmark(void) {
+	volatile int32_t       distance          = 123456;
+	volatile uint32_t      qn                = 0;
+	volatile uint32_t      rn                = 80368;
+	volatile uint32_t      fn                = 345177931; // reciprocal32(rn, 1000000)
+	volatile uint16_t      b                 = 12345;
+	volatile uint32_t      result;
+
+	MATHS_BENCH("muldivQR",       muldivQR(distance, qn, rn, 1000000UL));
+	MATHS_BENCH("muldivQRF",      muldivQRF(distance, qn, rn, fn, 1000000UL));
+	MATHS_BENCH("mul24x16",       mul24x16(distance, b));
+	MATHS_BENCH("mul32x16",       mul32x16(distance, b));
+	MATHS_BENCH("mul32x16_shr16", mul32x16_shr16(distance, b));
+	MATHS_BENCH("mul32x32_shr32", mul32x32_shr32(distance, fn));
+	MATHS_BENCH("reciprocal32",   reciprocal32(rn, 1000000UL));
+	MATHS_BENCH("udiv32",         fn / rn);
+}
+#endif
+
 /************************************************************************//**
 
   \brief Processes command stored in global \ref next_target.
@@ -30,6 +64,9 @@ uint32_t N_expected;
 *//*************************************************************************/
 
 void process_gcode_command(void *next_target) {
+	if (core_stopped)
+		core_halt();
+	
 	#ifdef	REQUIRE_LINENUMBER
 		if( 
 			((PARAMETER_asint(L_N) >= N_expected) && (PARAMETER_SEEN(L_N))) ||
@@ -65,10 +102,11 @@ void process_gcode_command(void *next_target) {
 				//? Any moves in progress are immediately terminated, then RepRap shuts down.  All motors and heaters are turned off.
 				//? It can be started again by pressing the reset button on the master microcontroller.  See also M0.
 				//?
+				//? Teacup acts on M112 as soon as it's received, even while the line before is still processed
+				//? or the queue is full. It reports positions and temperatures before it shuts down.
+				//?
 
-				cli();
-				for (;;)
-					core_emit(EVENT_TICK, 0);
+				core_halt();
 				break;
 
 			case 110:
@@ -95,6 +133,18 @@ void process_gcode_command(void *next_target) {
 
 				sersendf_P(PSTR("FIRMWARE_NAME:Teacup FIRMWARE_URL:http%%3A//github.com/triffid/Teacup_Firmware/ PROTOCOL_VERSION:%d.0 MACHINE_TYPE:Mendel "), 1);
 				break;
+
+			#ifdef	DEBUG
+			case 253:
+				//? --- M253: benchmark maths ---
+				//? Undocumented.
+				//? This command is only available in DEBUG builds.
+				//?
+				//? Report CPU cycles each of the fixed point routines in dda_maths.c takes, including a few cycles for reading the timer.
+				//?
+				maths_benchmark();
+				break;
+			#endif
 		} // switch (PARAMETER_asint(L_M))
 	} // else if (PARAMETER_SEEN(L_M))
 } // process_gcode_command()
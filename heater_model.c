@@ -0,0 +1,50 @@
+/** \file
+	\brief First order heater model for feed-forward temperature control.
+
+	Kept free of hardware dependencies, so t/heater_model_sim.c can run it on the host.
+*/
+
+#include	"heater_model.h"
+
+/** \brief steady state output for a temperature
+	\param model heater model
+	\param target temperature to hold, 14.2 fixed point
+	\return output which keeps the modelled heater at target, 0 if the model is disabled
+*/
+uint8_t heater_model_feedforward(const heater_model_t *model, uint16_t target) {
+	uint32_t               output;
+
+	if (model->gain == 0 || target <= model->ambient)
+		return 0;
+
+	output = ((uint32_t) (target - model->ambient) * 255 + (model->gain >> 1)) / model->gain;
+
+	return (output > 255) ? 255 : output;
+}
+
+/** \brief run the model for one sample
+	\param model heater model
+	\param temp modelled temperature, 14.2 fixed point shifted left by HEATER_MODEL_SHIFT
+	\param output heater output during this sample
+	\return modelled temperature after this sample, same scale as temp
+*/
+uint32_t heater_model_step(const heater_model_t *model, uint32_t temp, uint8_t output) {
+	int32_t                delta;
+	uint32_t               equilibrium;
+
+	// gain * output fits 24 bits, so it can take 8 of the fractional bits before dividing
+	equilibrium = ((uint32_t) model->ambient << HEATER_MODEL_SHIFT) +
+	              ((((uint32_t) model->gain * output << 8) / 255) << (HEATER_MODEL_SHIFT - 8));
+
+	if (model->tau <= 1)
+		return equilibrium;
+
+	delta = (int32_t) (equilibrium - temp);
+	// round towards the equilibrium, so the model never stalls just short of it
+	if (delta > 0)
+		delta = (delta + model->tau - 1) / model->tau;
+	else
+		delta = (delta - model->tau + 1) / model->tau;
+
+	return temp + delta;
+}
@@ -0,0 +1,31 @@
+#ifndef	_HEATER_MODEL_H
+#define	_HEATER_MODEL_H
+
+#include	<stdint.h>
+
+/// fractional bits of model temperatures on top of the usual 14.2 fixed point
+#define	HEATER_MODEL_SHIFT	16
+
+/**
+	\struct heater_model_t
+	\brief first order thermal model of a heater
+
+	At every sample the modelled temperature moves towards the equilibrium for the current output:
+	\f$T_{n+1} = T_n + \frac{T_{amb} + gain \cdot \frac{u}{255} - T_n}{\tau}\f$
+
+	This is enough to know how much power holding a given temperature takes, which lets heater_tick()
+	feed it forward instead of waiting for the integrator to find it.
+*/
+typedef struct heater_model_t {
+	uint16_t               gain;           ///< steady state rise above ambient at full output, 14.2 fixed point. 0 disables the model
+	uint16_t               tau;            ///< time constant, in heater_tick() samples
+	uint16_t               ambient;        ///< ambient temperature, 14.2 fixed point
+} heater_model_t;
+
+// output needed to hold target according to the model
+uint8_t heater_model_feedforward(const heater_model_t *model, uint16_t target);
+
+// advance a modelled temperature by one sample
+uint32_t heater_model_step(const heater_model_t *model, uint32_t temp, uint8_t output);
+
+#endif	/* _HEATER_MODEL_H */
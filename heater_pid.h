@@ -0,0 +1,97 @@
+#ifndef	_HEATER_PID_H
+#define	_HEATER_PID_H
+
+/** \file
+	\brief The PID step of heater_tick()
+
+	Kept free of hardware dependencies and inline, so t/heater_model_sim.c runs the very same
+	arithmetic on the host. TH_COUNT and PID_SCALE come from config.h, the simulation defines its
+	own.
+*/
+
+#include	<stdint.h>
+
+#include	"heater_model.h"
+
+/**
+	\struct heater_pid_t
+	\brief this struct holds the heater PID factors
+
+	PID is a fascinating way to control any closed loop control, combining the error (P), cumulative error (I) and rate at which we're approacing the setpoint (D) in such a way that when correctly tuned, the system will achieve target temperature quickly and with little to no overshoot
+
+	At every sample, we calculate \f$OUT = k_P (S - T) + k_I \int (S - T) + k_D \frac{dT}{dt}\f$ where S is setpoint and T is temperature.
+
+	The three factors kP, kI, kD are chosen to give the desired behaviour given the dynamics of the system.
+
+	See http://www.eetimes.com/design/embedded/4211211/PID-without-a-PhD for the full story
+*/
+typedef struct heater_pid_t {
+	int32_t                p_factor;       ///< scaled P factor
+	int32_t                i_factor;       ///< scaled I factor
+	int32_t                d_factor;       ///< scaled D factor
+	int16_t                i_limit;        ///< scaled I limit, such that \f$-i_{limit} < i_{factor} < i_{limit}\f$
+} heater_pid_t;
+
+/// \brief PID integrator and temperature history of one heater
+typedef struct heater_pid_state_t {
+	int16_t                heater_i;       ///< integrator, \f$-i_{limit} < \sum{\Delta t} < i_{limit}\f$
+
+	uint16_t               temp_history[TH_COUNT]; ///< store last TH_COUNT readings in a ring, so we can smooth out our differentiator
+	uint8_t                temp_history_pointer;   ///< pointer to last entry in ring
+} heater_pid_state_t;
+
+/** \brief one PID sample
+	\param pid factors
+	\param state integrator and history, updated
+	\param model heater model to feed forward, 0 - none
+	\param current_temp measured temperature, 14.2 fixed point
+	\param target_temp setpoint, 14.2 fixed point
+	\return heater output 0..255
+*/
+static inline uint8_t heater_pid_step(const heater_pid_t *pid, heater_pid_state_t *state, const heater_model_t *model, uint16_t current_temp, uint16_t target_temp) {
+	int16_t                t_error         = target_temp - current_temp;
+	int16_t                heater_d;
+	int32_t                pid_output_intermed;
+
+	state->temp_history[state->temp_history_pointer++] = current_temp;
+	state->temp_history_pointer &= (TH_COUNT - 1);
+
+	// integral
+	state->heater_i += t_error;
+	// prevent integrator wind-up
+	if (state->heater_i > pid->i_limit)
+		state->heater_i = pid->i_limit;
+	else if (state->heater_i < -pid->i_limit)
+		state->heater_i = -pid->i_limit;
+
+	// derivative
+	// note: D follows temp rather than error so there's no large derivative when the target changes
+	heater_d = state->temp_history[state->temp_history_pointer] - current_temp;
+
+	// combine factors
+	pid_output_intermed = (
+		(
+			(((int32_t) t_error) * pid->p_factor) +
+			(((int32_t) state->heater_i) * pid->i_factor) +
+			(((int32_t) heater_d) * pid->d_factor)
+		) / PID_SCALE
+	);
+
+	if (model && model->gain) {
+		// the model supplies the power holding the target takes, PID only has to correct its errors
+		pid_output_intermed += heater_model_feedforward(model, target_temp);
+
+		// so there's no point in winding up the integrator while the output saturates
+		if ((pid_output_intermed > 255 && t_error > 0) || (pid_output_intermed < 0 && t_error < 0))
+			state->heater_i -= t_error;
+	}
+
+	// rebase and limit factors
+	if (pid_output_intermed > 255)
+		return 255;
+	if (pid_output_intermed < 0)
+		return 0;
+	return pid_output_intermed & 0xFF;
+}
+
+#endif	/* _HEATER_PID_H */
@@ -51,6 +51,9 @@ void init(void) {
 
 	features_init();
 
+	// replace compiled in settings by saved ones
+	settings_init();
+
 	// enable interrupts
 	sei();
 
@@ -74,6 +77,8 @@ int main (void)
 			uint8_t c = serial_popchar();
 			gcode_parse_char(c);
 		}
+
+		clock_poll();
 	}
 }
 
@@ -60,6 +60,7 @@ void power_gcode_process(void *next_target){
 			//? --- M190: Power On ---
 			//? Undocumented.
 			//? This one is pointless in Teacup. Implemented to calm the RepRap gurus.
+			//? temperature.c also handles it as set bed temperature and wait, see there.
 			//?
 			power_on();
 			break;
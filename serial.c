@@ -98,6 +98,32 @@ void serial_init()
 	UCSR0B |= MASK(RXCIE0) | MASK(UDRIE0);
 }
 
+/// characters of "M112" matched so far, see serial_estop_check()
+static uint8_t rx_estop_match = 0;
+
+/** \brief look for M112 in received characters
+
+	Runs in the receive interrupt, so an emergency stop works even while the main loop is stuck
+	waiting for queue space or the receive buffer is full. M1120 and the like don't match.
+*/
+static void serial_estop_check(uint8_t c) {
+	if (c >= 'a' && c <= 'z')
+		c &= ~32;
+
+	if (rx_estop_match == 4) {
+		if (c < '0' || c > '9')
+			core_emergency_stop();
+		rx_estop_match = 0;
+	}
+
+	switch (rx_estop_match) {
+		case 0:  rx_estop_match = (c == 'M');                           break;
+		case 1:  rx_estop_match = (c == '1') ? 2 : (c == 'M');          break;
+		case 2:  rx_estop_match = (c == '1') ? 3 : (c == 'M');          break;
+		case 3:  rx_estop_match = (c == '2') ? 4 : (c == 'M');          break;
+	}
+}
+
 /*
 	Interrupts
 */
@@ -113,16 +139,13 @@ ISR(USART0_RX_vect)
 {
 	// save status register
 	uint8_t sreg_save = SREG;
+	// reading the character also stops the interrupt logic from swamping us with retries
+	uint8_t c = UDR0;
 
-	if (buf_canwrite(rx))
-		buf_push(rx, UDR0);
-	else {
-		uint8_t trash;
+	serial_estop_check(c);
 
-		// not reading the character makes the interrupt logic to swamp us with retries, so better read it and throw it away
-		trash = UDR0;
-		(void)trash; // remove warning
-	}
+	if (buf_canwrite(rx))
+		buf_push(rx, c);
 
 	#ifdef	XONXOFF
 	if (flowflags & FLOWFLAG_STATE_XON && buf_canwrite(rx) <= 16) {
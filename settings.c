@@ -0,0 +1,256 @@
+#include	"settings.h"
+
+/** \file
+	\brief Persistent settings
+
+	Features register blocks of RAM holding tunable values. All of them are saved to and loaded
+	from eeprom as one image, so the running firmware only ever uses the RAM copies.
+
+	The eeprom is split into SETTINGS_SLOTS slots, all of it unless SETTINGS_SLOT_SIZE says
+	otherwise. Every save goes to the slot after the newest one, so writes are spread across all of them, and a save interrupted by reset leaves the previous
+	image intact. Each image starts with a header holding the schema version, a sequence number, the
+	image length and one CRC16 over header and data. Images with a different version or length, like
+	after changing the registered blocks, are ignored and the compiled in defaults stay active.
+*/
+
+#include	<stddef.h>
+#include	<string.h>
+#include	<avr/eeprom.h>
+#include	<avr/pgmspace.h>
+#include	<util/crc16.h>
+
+#include	"common.h"
+
+#ifndef	SETTINGS_SLOTS
+/// number of slots writes are spread across. Only two with less than 1 KiB of eeprom, e.g. on the
+/// ATmega168, so a slot still holds some 250 bytes
+#if E2END + 1 < 1024
+#define	SETTINGS_SLOTS		2
+#else
+#define	SETTINGS_SLOTS		4
+#endif
+#endif
+#ifndef	SETTINGS_SLOT_SIZE
+/// size of one slot including its header, in bytes. The slots share all of the eeprom
+#define	SETTINGS_SLOT_SIZE	((E2END + 1) / SETTINGS_SLOTS)
+#endif
+#if SETTINGS_SLOTS * SETTINGS_SLOT_SIZE > E2END + 1
+#error SETTINGS_SLOTS * SETTINGS_SLOT_SIZE is more than the eeprom of this chip
+#endif
+#ifndef	SETTINGS_BLOCKS
+/// maximum number of registered blocks, one per axis and about one per feature
+#define	SETTINGS_BLOCKS		12
+#endif
+
+/// bump whenever the meaning of saved data changes without changing its length
+#define	SETTINGS_VERSION	1
+
+typedef struct {
+	uint16_t               version;        ///< SETTINGS_VERSION
+	uint16_t               sequence;       ///< incremented with every save, the highest valid one wins
+	uint16_t               length;         ///< length of data following the header
+	uint16_t               crc;            ///< crc16 over the header up to here and the data
+} settings_header_t;
+
+typedef struct {
+	void                  *ram;
+	uint16_t               size;
+	settings_defaults_func defaults;
+} settings_block_t;
+
+static settings_block_t       settings_blocks[SETTINGS_BLOCKS];
+static uint8_t                settings_blocks_count = 0;
+static uint16_t               settings_length = 0;
+/// bytes of blocks which didn't fit, they aren't saved
+static uint16_t               settings_lost = 0;
+
+/// slot holding the newest image and its sequence number
+static uint8_t                settings_slot = SETTINGS_SLOTS - 1;
+static uint16_t               settings_sequence = 0;
+
+static uint8_t EEMEM          settings_EE[SETTINGS_SLOTS][SETTINGS_SLOT_SIZE];
+
+// provided by the linker: where initialised data lives in RAM and where its initial values are in flash
+extern uint8_t __data_start;
+extern uint8_t __data_end;
+extern uint8_t __data_load_start;
+
+/** \brief make a block of RAM persistent
+	\param ram start of the block
+	\param size size of the block in bytes
+	\param defaults function restoring the block's defaults for M502, 0 - restore compiled in values
+	\return 0 on success, 255 if the block doesn't fit
+
+	Without a defaults function, initialised variables get their initial values back from flash,
+	everything else is zeroed. Register in the same order on every start, the image has no names.
+
+	How much the features register depends on the config, e.g. the number of heaters, so it can
+	only be checked here. A block which doesn't fit keeps working from RAM, every M500 complains.
+*/
+uint8_t settings_register(void *ram, uint16_t size, settings_defaults_func defaults) {
+	if (settings_blocks_count >= SETTINGS_BLOCKS ||
+	    settings_length + size > SETTINGS_SLOT_SIZE - sizeof(settings_header_t)) {
+		sersendf_P(PSTR("!! settings: no room for %u bytes\n"), size);
+		settings_lost += size;
+		return 255;
+	}
+
+	settings_blocks[settings_blocks_count].ram      = ram;
+	settings_blocks[settings_blocks_count].size     = size;
+	settings_blocks[settings_blocks_count].defaults = defaults;
+	settings_blocks_count++;
+	settings_length += size;
+
+	return 0;
+}
+
+/// crc of a slot, computed from eeprom. Slot must have a plausible length
+static uint16_t settings_crc(uint8_t slot, uint16_t length) {
+	uint8_t               *p = settings_EE[slot];
+	uint16_t               crc = 0;
+
+	length += offsetof(settings_header_t, crc);
+	for (; length; length--, p++) {
+		if (p == &settings_EE[slot][offsetof(settings_header_t, crc)])
+			p += sizeof(uint16_t);
+		crc = _crc16_update(crc, eeprom_read_byte(p));
+	}
+	return crc;
+}
+
+/** \brief read the newest valid image into the registered blocks
+	\return 255 if one was found, 0 if not, in which case RAM is left untouched
+*/
+uint8_t settings_load(void) {
+	settings_header_t      header;
+	uint8_t                slot, found = 0;
+	uint8_t                i;
+	uint16_t               offset;
+
+	for (slot = 0; slot < SETTINGS_SLOTS; slot++) {
+		eeprom_read_block(&header, settings_EE[slot], sizeof(header));
+
+		if (header.version != SETTINGS_VERSION || header.length != settings_length)
+			continue;
+		if (settings_crc(slot, header.length) != header.crc)
+			continue;
+
+		// sequence numbers wrap around, compare them as a difference
+		if (found == 0 || (int16_t) (header.sequence - settings_sequence) > 0) {
+			settings_slot     = slot;
+			settings_sequence = header.sequence;
+			found = 255;
+		}
+	}
+
+	if (found == 0)
+		return 0;
+
+	offset = sizeof(settings_header_t);
+	for (i = 0; i < settings_blocks_count; i++) {
+		eeprom_read_block(settings_blocks[i].ram, &settings_EE[settings_slot][offset], settings_blocks[i].size);
+		offset += settings_blocks[i].size;
+	}
+
+	return 255;
+}
+
+/// write all registered blocks into the slot after the newest one
+void settings_save(void) {
+	settings_header_t      header;
+	uint8_t                slot;
+	uint8_t                i;
+	uint16_t               offset;
+
+	if (settings_lost)
+		sersendf_P(PSTR("!! settings: %u bytes don't fit, not saved\n"), settings_lost);
+
+	slot = settings_slot + 1;
+	if (slot >= SETTINGS_SLOTS)
+		slot = 0;
+
+	// data first, so the header only becomes valid once everything is written
+	offset = sizeof(settings_header_t);
+	for (i = 0; i < settings_blocks_count; i++) {
+		eeprom_update_block(settings_blocks[i].ram, &settings_EE[slot][offset], settings_blocks[i].size);
+		offset += settings_blocks[i].size;
+	}
+
+	header.version  = SETTINGS_VERSION;
+	header.sequence = settings_sequence + 1;
+	header.length   = settings_length;
+	eeprom_update_block(&header, settings_EE[slot], offsetof(settings_header_t, crc));
+	header.crc      = settings_crc(slot, settings_length);
+	eeprom_update_block(&header.crc, &settings_EE[slot][offsetof(settings_header_t, crc)], sizeof(header.crc));
+
+	settings_slot     = slot;
+	settings_sequence = header.sequence;
+}
+
+/// restore defaults of all registered blocks, RAM only
+void settings_defaults(void) {
+	uint8_t                i;
+	uint8_t               *ram;
+
+	for (i = 0; i < settings_blocks_count; i++) {
+		ram = (uint8_t *) settings_blocks[i].ram;
+
+		if (settings_blocks[i].defaults)
+			settings_blocks[i].defaults();
+		else if (ram >= &__data_start && ram < &__data_end)
+			#if FLASHEND > 0xFFFF
+			// initial values may be above 64 KiB of flash
+			memcpy_PF(ram, pgm_get_far_address(__data_load_start) + (ram - &__data_start), settings_blocks[i].size);
+			#else
+			memcpy_P(ram, &__data_load_start + (ram - &__data_start), settings_blocks[i].size);
+			#endif
+		else
+			memset(ram, 0, settings_blocks[i].size);
+	}
+}
+
+void settings_gcode(void *next_target) {
+	if(! PARAMETER_SEEN(L_M))
+		return;
+
+	switch(PARAMETER_asint(L_M)){
+		case 500:
+			//? --- M500: save settings ---
+			//?
+			//? Example: M500
+			//?
+			//? Save to eeprom what the features built in can tune: steps per unit, feedrates, limits and
+			//? backlash of the axes, heater PID factors and models, temperature sensor offsets, tool
+			//? offsets, standby temperatures and pressure advance, retract settings and the bed mesh.
+			//?
+			settings_save();
+			break;
+
+		case 501:
+			//? --- M501: load settings ---
+			//?
+			//? Example: M501
+			//?
+			//? Throw away changes since the last M500. Saved settings are also loaded on every start.
+			//?
+			if (settings_load() == 0)
+				serial_writestr_P(PSTR("no saved settings "));
+			break;
+
+		case 502:
+			//? --- M502: restore default settings ---
+			//?
+			//? Example: M502
+			//?
+			//? Go back to the values compiled into the firmware. Send M500 afterwards to make that permanent.
+			//?
+			settings_defaults();
+			break;
+	}
+}
+
+void settings_init(void) {
+	settings_load();
+
+	core_register(EVENT_GCODE_PROCESS, &settings_gcode);
+}
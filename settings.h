@@ -0,0 +1,24 @@
+#ifndef	_SETTINGS_H
+#define	_SETTINGS_H
+
+#include	<stdint.h>
+
+/// restores a block's defaults, see settings_register()
+typedef void (*settings_defaults_func)(void);
+
+// make a block of RAM persistent. Call from feature init functions
+uint8_t settings_register(void *ram, uint16_t size, settings_defaults_func defaults);
+
+// load saved settings and register M500-M502. Call once after all features are initialised
+void settings_init(void);
+
+// write all registered blocks to eeprom
+void settings_save(void);
+
+// read all registered blocks from eeprom, returns 0 if there were no valid settings
+uint8_t settings_load(void);
+
+// restore all registered blocks to their defaults
+void settings_defaults(void);
+
+#endif	/* _SETTINGS_H */
@@ -0,0 +1,172 @@
+/** \file
+	\brief Host side equivalence test of the fixed point routines in dda_maths.c
+
+	Build and run with "make check". Every multiply is compared against a 64 bit
+	reference, muldivQRF() against muldivQR() it replaces in dda_create(): exhaustively
+	over +-2^19 um for the steps per meter values of the shipped configs, then with
+	random operands. int_sqrt64() results are squared back. Exit status is non-zero if any
+	check fails.
+
+	Pass -b to get a rough per call timing of each routine on the host. For cycle
+	counts on the ATmega itself use M253 in a DEBUG build.
+*/
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<time.h>
+
+#include	"dda_maths.h"
+
+#define	RANDOM_RUNS	10000000L
+
+static int failures;
+
+#define	CHECK(cond, ...) do {                         \
+		if (! (cond)) {                               \
+			printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__);                        \
+			printf("\n");                               \
+			if (++failures > 20) exit(1);               \
+		}                                             \
+	} while (0)
+
+/// xorshift, deterministic so failures can be reproduced
+static uint32_t rnd(void) {
+	static uint32_t x = 2463534242UL;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+/// random value with a random number of significant bits, so small operands get tested as well
+static uint32_t rnd_bits(uint8_t max_bits) {
+	uint8_t bits = rnd() % (max_bits + 1);
+
+	return bits ? rnd() >> (32 - bits) : 0;
+}
+
+static void test_multiply(void) {
+	long i;
+
+	for (i = 0; i < RANDOM_RUNS; i++) {
+		uint32_t a = rnd_bits(32), b = rnd_bits(32);
+		uint16_t b16 = (uint16_t)b;
+		uint32_t a24 = a & 0xFFFFFF;
+
+		CHECK(mul24x16(a24, b16) == (uint32_t)((uint64_t)a24 * b16), "mul24x16(%u, %u)", a24, b16);
+		CHECK(mul32x16(a, b16) == (uint32_t)((uint64_t)a * b16), "mul32x16(%u, %u)", a, b16);
+		CHECK(mul32x16_shr16(a, b16) == (uint32_t)(((uint64_t)a * b16) >> 16), "mul32x16_shr16(%u, %u)", a, b16);
+		CHECK(mul32x32_shr32(a, b) == (uint32_t)(((uint64_t)a * b) >> 32), "mul32x32_shr32(%u, %u)", a, b);
+	}
+	CHECK(mul32x32_shr32(0xFFFFFFFF, 0xFFFFFFFF) == 0xFFFFFFFE, "mul32x32_shr32 maximum");
+	CHECK(mul32x16_shr16(0xFFFFFFFF, 0xFFFF) == 0xFFFEFFFF, "mul32x16_shr16 maximum");
+}
+
+static void test_reciprocal(void) {
+	long i;
+
+	for (i = 0; i < RANDOM_RUNS / 10; i++) {
+		uint32_t d = rnd_bits(31) | 1;
+		uint32_t n = rnd() % d;
+
+		CHECK(reciprocal32(n, d) == (uint32_t)(((uint64_t)n << 32) / d), "reciprocal32(%u, %u)", n, d);
+	}
+}
+
+/// muldivQRF() must be a drop-in replacement, compare against muldivQR(), not against exact maths
+static void check_muldiv(int32_t m, uint32_t multiplier, uint32_t divisor) {
+	uint32_t qn = multiplier / divisor, rn = multiplier % divisor;
+	uint32_t fn = reciprocal32(rn, divisor);
+	int32_t  expected = muldivQR(m, qn, rn, divisor);
+	int32_t  got      = muldivQRF(m, qn, rn, fn, divisor);
+
+	CHECK(got == expected, "muldivQRF(%d, %u / %u) = %d, muldivQR() = %d", m, multiplier, divisor, got, expected);
+}
+
+static void test_muldiv(void) {
+	static const uint32_t steps_per_m[] = { 1, 10047, 11036, 35200, 40000, 80368, 320000, 999999, 1000000, 1000001, 2000000, 3333592 };
+	uint8_t  s;
+	int32_t  m;
+	long     i;
+
+	for (s = 0; s < sizeof(steps_per_m) / sizeof(steps_per_m[0]); s++)
+		for (m = -(1L << 19); m <= (1L << 19); m++)
+			check_muldiv(m, steps_per_m[s], 1000000UL);
+
+	for (i = 0; i < RANDOM_RUNS; i++) {
+		uint32_t divisor = rnd_bits(30) | 1;
+		uint32_t multiplier = rnd_bits(32);
+		uint32_t a = rnd_bits(31);
+		int32_t  m = (rnd() & 1) ? -(int32_t)a : (int32_t)a;
+
+		// both need qn to fit into 16 bits and the result to fit into 31 bits
+		if (multiplier / divisor > 0xFFFF)
+			continue;
+		if ((uint64_t)a * multiplier / divisor >= 0x7FFFFFFF)
+			continue;
+		check_muldiv(m, multiplier, divisor);
+	}
+}
+
+static void test_sqrt(void) {
+	long i;
+
+	for (i = 0; i < RANDOM_RUNS / 10; i++) {
+		uint64_t a = ((uint64_t)rnd_bits(32) << 32) | rnd();
+		uint64_t r = int_sqrt64(a);
+
+		CHECK(r * r <= a && (r == 0xFFFFFFFF || (r + 1) * (r + 1) > a), "int_sqrt64(%llu) = %llu", (unsigned long long)a, (unsigned long long)r);
+	}
+	CHECK(int_sqrt64(0) == 0, "int_sqrt64(0)");
+	CHECK(int_sqrt64(0xFFFFFFFFFFFFFFFFULL) == 0xFFFFFFFF, "int_sqrt64 maximum");
+}
+
+#define	BENCH(name, expr) do {                                                 \
+		clock_t  start = clock();                                                \
+		uint32_t sum = 0;                                                        \
+		long     i;                                                              \
+		for (i = 0; i < RANDOM_RUNS; i++) {                                      \
+			uint32_t x = arg[i & 1023];                                            \
+			sum += (expr);                                                         \
+		}                                                                        \
+		printf("%-16s %6.1f ns/call (%08x)\n", name,                             \
+		       (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / RANDOM_RUNS, sum); \
+	} while (0)
+
+static void benchmark(void) {
+	static uint32_t arg[1024];
+	uint32_t        fn = reciprocal32(80368 % 1000000UL, 1000000UL);
+	int             i;
+
+	for (i = 0; i < 1024; i++)
+		arg[i] = rnd_bits(24);
+
+	BENCH("muldivQR",       muldivQR(x, 0, 80368, 1000000UL));
+	BENCH("muldivQRF",      muldivQRF(x, 0, 80368, fn, 1000000UL));
+	BENCH("mul24x16",       mul24x16(x, 12345));
+	BENCH("mul32x16",       mul32x16(x, 12345));
+	BENCH("mul32x16_shr16", mul32x16_shr16(x, 12345));
+	BENCH("mul32x32_shr32", mul32x32_shr32(x, fn));
+	BENCH("reciprocal32",   reciprocal32(x, 0x1000000));
+	BENCH("int_sqrt64",     int_sqrt64((uint64_t)x * x));
+}
+
+int main(int argc, char **argv) {
+	test_multiply();
+	test_reciprocal();
+	test_muldiv();
+	test_sqrt();
+
+	if (argc > 1 && strcmp(argv[1], "-b") == 0)
+		benchmark();
+
+	if (failures) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,83 @@
+/** \file
+	\brief Host side test of the number conversion in utils.c
+
+	Build and run with "make check". Numbers are read digit by digit with decfloat_add_digit()
+	the way gcode_parse.c does, then stored with decfloat_set_digits() and compared against
+	the expected fixed point value and integer. Exit status is non-zero if any check fails.
+*/
+
+#include	<stdio.h>
+#include	<stdlib.h>
+
+#include	"utils.h"
+
+/// defined in serial.c in the firmware
+const uint32_t powers[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+static int failures;
+
+#define	CHECK(cond, ...) do {                         \
+		if (! (cond)) {                               \
+			printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__);                        \
+			printf("\n");                               \
+			failures++;                                 \
+		}                                             \
+	} while (0)
+
+/// read a number like the S_PARSE_NUMBER state of gcode_parse_char()
+static decfloat parse(const char *s) {
+	uint32_t mantissa = 0;
+	uint8_t  exponent = 0;
+	uint8_t  sign     = 0;
+	decfloat df;
+
+	for (; *s; s++) {
+		if (*s >= '0' && *s <= '9')
+			decfloat_add_digit(&mantissa, &exponent, *s - '0');
+		else if (*s == '-') {
+			sign     = 1;
+			exponent = 0;
+			mantissa = 0;
+		}
+		else if (*s == '.' && exponent == 0)
+			exponent = 1;
+	}
+	decfloat_set_digits(&df, mantissa, exponent, sign);
+	return df;
+}
+
+static void test_parse(const char *s, int32_t value, int32_t asint) {
+	decfloat df = parse(s);
+
+	CHECK(df.value == value, "%s: value %ld, expected %ld", s, (long)df.value, (long)value);
+	CHECK(df.asint == asint, "%s: asint %ld, expected %ld", s, (long)df.asint, (long)asint);
+}
+
+int main(void) {
+	test_parse("0",             0,          0);
+	test_parse("12",            120000,     12);
+	test_parse("-12.5",         -125000,    -13);
+	test_parse("1.2345",        12345,      1);
+	// the fifth decimal rounds
+	test_parse("1.23456",       12346,      1);
+	test_parse("0.00005",       1,          0);
+	test_parse("0.00004",       0,          0);
+	test_parse("1.234567",      12346,      1);
+	// five decimals which don't fit into 32 bits, as slicers write them on long prints
+	test_parse("43000.12345",   430001234,  43000);
+	test_parse("-43000.12345",  -430001234, -43000);
+	test_parse("42949.67295",   429496729,  42950);
+	test_parse("99999.99999",   999999999,  100000);
+	test_parse("214748.36479",  2147483647, 214748);
+	// asint keeps integers beyond what value holds, value saturates
+	test_parse("123456789",     2147483647, 123456789);
+	test_parse("214748.4",      2147483647, 214748);
+
+	if (failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
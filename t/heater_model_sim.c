@@ -0,0 +1,172 @@
+/** \file
+	\brief Host side simulation of heater_model.c
+
+	Build and run with "make check". A heater is simulated with the first order model plus a lagging
+	sensor, controlled by heater_pid_step() from heater_pid.h, the PID step heater_tick() runs, with
+	and without model feed-forward. Exit status is non-zero if any check fails.
+
+	Pass -v to get a CSV trace of every closed loop run on stdout.
+*/
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+
+/// config.h values heater_pid.h depends on
+#define	PID_SCALE	1024L
+#define	TH_COUNT	8
+
+#include	"heater_model.h"
+#include	"heater_pid.h"
+
+/// tuned for the plant in test_closed_loop(); the firmware defaults make it limit cycle
+static const heater_pid_t pid_factors = { 8192, 16, 81920, 16320 };
+
+static int verbose;
+static int failures;
+
+#define	CHECK(cond, ...) do {                         \
+		if (! (cond)) {                               \
+			printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__);                        \
+			printf("\n");                               \
+			failures++;                                 \
+		}                                             \
+	} while (0)
+
+typedef struct {
+	uint32_t settle;      ///< first sample after which temperature stays within 2 degrees of target
+	uint16_t overshoot;   ///< maximum temperature above target, 14.2
+	int32_t  final_error; ///< target - temperature at the end, 14.2
+} result_t;
+
+/** run a closed loop
+	\param name label for the -v trace
+	\param plant the heater as it really is
+	\param ff the model the controller believes in, 0 for plain PID
+	\param sensor_tau sensor lag in samples
+	\param start start temperature, 14.2
+	\param target target temperature, 14.2
+	\param samples simulation length
+*/
+static result_t closed_loop(const char *name, const heater_model_t *plant, const heater_model_t *ff, uint16_t sensor_tau, uint16_t start, uint16_t target, uint32_t samples) {
+	result_t     r = { 0, 0, 0 };
+	heater_pid_state_t s;
+	uint32_t     temp = (uint32_t) start << HEATER_MODEL_SHIFT;
+	uint32_t     reading = temp;
+	uint8_t      output = 0;
+	uint32_t     n;
+	int          i;
+
+	memset(&s, 0, sizeof(s));
+	for (i = 0; i < TH_COUNT; i++)
+		s.temp_history[i] = start;
+
+	for (n = 0; n < samples; n++) {
+		uint16_t t = reading >> HEATER_MODEL_SHIFT;
+
+		output = heater_pid_step(&pid_factors, &s, ff, t, target);
+		temp = heater_model_step(plant, temp, output);
+
+		// sensor lags behind the heater block
+		if (sensor_tau > 1)
+			reading += ((int32_t) (temp - reading)) / sensor_tau;
+		else
+			reading = temp;
+
+		t = temp >> HEATER_MODEL_SHIFT;
+		if (t > target && t - target > r.overshoot)
+			r.overshoot = t - target;
+		if (abs((int) t - (int) target) > 8)
+			r.settle = n + 1;
+
+		if (verbose)
+			printf("%s,%u,%u,%u,%u\n", name, n, t, (unsigned) (reading >> HEATER_MODEL_SHIFT), output);
+	}
+
+	r.final_error = (int32_t) target - (int32_t) (temp >> HEATER_MODEL_SHIFT);
+	return r;
+}
+
+/// step response: after tau samples at full power the model covers 63.2% of the way
+static void test_step_response(void) {
+	heater_model_t m = { 1000, 500, 100 };
+	uint32_t       temp = (uint32_t) m.ambient << HEATER_MODEL_SHIFT;
+	uint32_t       n;
+	uint16_t       t;
+
+	for (n = 0; n < m.tau; n++)
+		temp = heater_model_step(&m, temp, 255);
+	t = temp >> HEATER_MODEL_SHIFT;
+	// 100 + 632 = 732, allow a percent for discretisation
+	CHECK(t >= 722 && t <= 742, "step response after tau: %u, expected ~732", t);
+
+	for (n = 0; n < 20UL * m.tau; n++)
+		temp = heater_model_step(&m, temp, 255);
+	t = temp >> HEATER_MODEL_SHIFT;
+	CHECK(t == m.ambient + m.gain, "step response settles at %u, expected %u", t, m.ambient + m.gain);
+
+	for (n = 0; n < 20UL * m.tau; n++)
+		temp = heater_model_step(&m, temp, 0);
+	t = temp >> HEATER_MODEL_SHIFT;
+	CHECK(t == m.ambient, "cools down to %u, expected %u", t, m.ambient);
+}
+
+/// open loop: the feed-forward output alone holds the model at target, within one output step
+static void test_feedforward_inverse(void) {
+	heater_model_t m = { 1200, 300, 88 };
+	uint16_t       target;
+
+	for (target = m.ambient + 4; target < m.ambient + m.gain; target += 37) {
+		uint8_t  u = heater_model_feedforward(&m, target);
+		uint32_t temp = (uint32_t) m.ambient << HEATER_MODEL_SHIFT;
+		uint32_t n;
+		int      err;
+
+		for (n = 0; n < 20UL * m.tau; n++)
+			temp = heater_model_step(&m, temp, u);
+		err = (int) (temp >> HEATER_MODEL_SHIFT) - (int) target;
+		CHECK(abs(err) <= m.gain / 255 / 2 + 1, "feed-forward %u for target %u settles %d off", u, target, err);
+	}
+
+	m.gain = 0;
+	CHECK(heater_model_feedforward(&m, 800) == 0, "disabled model must not feed forward");
+	m.gain = 1000;
+	CHECK(heater_model_feedforward(&m, 50) == 0, "no output below ambient");
+	CHECK(heater_model_feedforward(&m, 60000) == 255, "output clamps at 255");
+}
+
+/// closed loop: feed-forward with a 10% wrong model must settle faster and overshoot less than plain PID
+static void test_closed_loop(void) {
+	// 300 C rise at full power, 45 s time constant at 10 ms samples, 25 C ambient
+	heater_model_t plant = { 1200, 4500, 100 };
+	heater_model_t model = { 1320, 4500, 100 };
+	uint16_t       target = 200 * 4;
+	result_t       pid, pid_ff;
+
+	pid    = closed_loop("pid",    &plant, 0,      150, plant.ambient, target, 60000);
+	pid_ff = closed_loop("pid_ff", &plant, &model, 150, plant.ambient, target, 60000);
+
+	printf("plain PID:    settle %6u samples, overshoot %3u.%02u C, final error %d\n", pid.settle, pid.overshoot >> 2, (pid.overshoot & 3) * 25, pid.final_error);
+	printf("feed-forward: settle %6u samples, overshoot %3u.%02u C, final error %d\n", pid_ff.settle, pid_ff.overshoot >> 2, (pid_ff.overshoot & 3) * 25, pid_ff.final_error);
+
+	CHECK(abs(pid_ff.final_error) <= 2, "feed-forward final error %d", pid_ff.final_error);
+	CHECK(pid_ff.settle < pid.settle, "feed-forward settles in %u samples, plain PID in %u", pid_ff.settle, pid.settle);
+	CHECK(pid_ff.overshoot < pid.overshoot, "feed-forward overshoots %u, plain PID %u", pid_ff.overshoot, pid.overshoot);
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1 && strcmp(argv[1], "-v") == 0)
+		verbose = 1;
+
+	test_step_response();
+	test_feedforward_inverse();
+	test_closed_loop();
+
+	if (failures) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
@@ -16,7 +16,8 @@
 #include	"arduino.h"
 #include	"common.h"
 
-#define NUM_TIMERS 3
+/// one per stepdir axis plus software PWM channels
+#define NUM_TIMERS 6
 timer_t timers[NUM_TIMERS];
 volatile uint8_t        timers_used = 0; ///< timer_new counter
 
@@ -25,6 +26,16 @@ volatile uint8_t        timers_used = 0; ///< timer_new counter
 /// convert back to ms from cpu ticks so our system clock runs properly if you change TICK_TIME
 #define		TICK_TIME_MS	(TICK_TIME / (F_CPU / 1000))
 
+/// flags raised by the clock interrupt and consumed by clock_poll()
+volatile uint8_t	clock_flag_10ms  = 0;
+volatile uint8_t	clock_flag_250ms = 0;
+volatile uint8_t	clock_flag_1s    = 0;
+
+/// clock interrupt counters
+static uint8_t	clock_counter_10ms  = 0;
+static uint8_t	clock_counter_250ms = 0;
+static uint8_t	clock_counter_1s    = 0;
+
 /// time until next step, as output compare register is too small for long step times
 uint32_t	next_step_time;
 uint32_t	delay_time;
@@ -36,23 +47,9 @@ uint32_t	step_extra_time = 0;
 
 void timer_hardware_set(uint32_t delay);
 
-void timers_gcode(void *next_target){
-	if(! PARAMETER_SEEN(L_M))
-		return;
-	
-	switch(PARAMETER_asint(L_M)){
-		case 112:
-			//? --- M112: Emergency Stop ---
-			//?
-			//? Example: M112
-			//?
-			//? Any moves in progress are immediately terminated, then RepRap shuts down.  All motors and heaters are turned off.
-			//? It can be started again by pressing the reset button on the master microcontroller.  See also M0.
-			//?
-			
-			timers_stop();
-			break;
-	}
+/// emergency stop, no more step interrupts
+static void timers_emergency_stop(void *data){
+	timers_stop();
 }
 
 /// initialise timer and enable system clock interrupt.
@@ -64,7 +61,60 @@ void timers_init()
 	// Normal Mode
 	TCCR1B = MASK(CS10);
 	
-	core_register(EVENT_GCODE_PROCESS, &timers_gcode);
+	// comparator B is the system clock
+	OCR1B = TICK_TIME;
+	TIMSK1 |= MASK(OCIE1B);
+	
+	core_register(EVENT_EMERGENCY_STOP, &timers_emergency_stop);
+}
+
+/// comparator B is the system clock. It only raises flags, all the work is done by clock_poll() in the main loop.
+ISR(TIMER1_COMPB_vect) {
+	// save status register
+	uint8_t sreg_save = SREG;
+
+	// set output compare register to the next clock tick
+	OCR1B = (OCR1B + TICK_TIME) & 0xFFFF;
+
+	clock_counter_10ms += TICK_TIME_MS;
+	if (clock_counter_10ms >= 10) {
+		clock_counter_10ms -= 10;
+		clock_flag_10ms = 1;
+
+		clock_counter_250ms += 1;
+		if (clock_counter_250ms >= 25) {
+			clock_counter_250ms -= 25;
+			clock_flag_250ms = 1;
+
+			clock_counter_1s += 1;
+			if (clock_counter_1s >= 4) {
+				clock_counter_1s -= 4;
+				clock_flag_1s = 1;
+			}
+		}
+	}
+
+	// restore status register
+	MEMORY_BARRIER();
+	SREG = sreg_save;
+}
+
+/// emit clock events raised by the clock interrupt. Call this from every place which loops for a long time.
+void clock_poll(void) {
+	// an emergency stop from an interrupt ends up here
+	if (core_stopped)
+		core_halt();
+
+	ifclock(clock_flag_10ms)
+		core_emit(EVENT_TICK_10MS, 0);
+
+	ifclock(clock_flag_250ms)
+		core_emit(EVENT_TICK_250MS, 0);
+
+	ifclock(clock_flag_1s)
+		core_emit(EVENT_TICK_1S, 0);
+
+	core_emit(EVENT_TICK, 0);
 }
 
 void timers_update(uint32_t time_passed){
@@ -155,7 +205,7 @@ void timer_hardware_set(uint32_t delay)
 	#endif /* ACCELERATION_TEMPORAL */
 
 	// re-enable clock interrupt in case we're recovering from emergency stop
-	//TIMSK1 |= MASK(OCIE1B);
+	TIMSK1 |= MASK(OCIE1B);
 
 	// An interrupt would make all our timing calculations invalid,
 	// so stop that here.
@@ -225,6 +275,11 @@ void timer_hardware_set(uint32_t delay)
 
 /// stop timers - emergency stop
 void timers_stop() {
+	uint8_t  i;
+	
+	for (i = 0; i < NUM_TIMERS; i++)
+		timers[i].enabled = 0;
+	
 	// disable all interrupts
 	TIMSK1 = 0;
 }
@@ -250,6 +305,9 @@ void timer_disable(uint8_t id){
 	timers[id].enabled   = 0;
 }
 void timer_charge(uint8_t id, uint32_t delay){
+	if(core_stopped)
+		return;
+	
 	timers[id].delay     = delay;
 	timer_enable(id);
 	
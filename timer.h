@@ -20,6 +20,8 @@ extern volatile uint8_t	clock_flag_1s;
 // and then clear the flag.
 #define	ifclock(F)	for (;F;F=0 )
 
+void clock_poll(void);
+
 typedef void (*timer_callback)(uint8_t id, void *userdata);
 
 typedef struct timer_t {
@@ -1,46 +1,61 @@
-#include "common.h"
 #include "utils.h"
 
 /*
-	utility functions
+	utility functions, free of hardware dependencies so t/decfloat_test.c can run them on the host
 */
-extern const uint32_t powers[];  // defined in sermsg.c
+extern const uint32_t powers[];  // defined in serial.c
 
-/// convert a floating point input value into an integer with appropriate scaling.
-/// \param *df pointer to floating point structure that holds fp value to convert
+/// convert a decfloat into an integer with appropriate scaling, see decfloat_to_int().
+/// \param *df pointer to the number to convert
 /// \param multiplicand multiply by this amount during conversion to integer
-///
-/// Tested for up to 42'000 mm (accurate), 420'000 mm (precision 10 um) and
-/// 4'200'000 mm (precision 100 um).
-int32_t decfloat_to_int(decfloat *df, uint16_t multiplicand) {
-	uint32_t	r = df->mantissa;
-	uint8_t	e = df->exponent;
-
-	// e=1 means we've seen a decimal point but no digits after it, and e=2 means we've seen a decimal point with one digit so it's too high by one if not zero
-	if (e)
-		e--;
-
-	// This raises range for mm by factor 1000 and for inches by factor 100.
-	// It's a bit expensive, but we should have the time while parsing.
-	while (e && multiplicand % 10 == 0) {
+int32_t decfloat_scale(decfloat *df, uint16_t multiplicand) {
+	int32_t		v = df->value;
+	uint32_t	r = (v < 0) ? -v : v;
+	uint16_t	divisor = DECFLOAT_ONE;
+
+	// this raises the range of r * multiplicand by the common factors of ten
+	while (divisor > 1 && multiplicand % 10 == 0) {
 		multiplicand /= 10;
-		e--;
+		divisor /= 10;
 	}
 
 	r *= multiplicand;
-	if (e)
-		r = (r + powers[e] / 2) / powers[e];
+	if (divisor > 1)
+		r = (r + divisor / 2) / divisor;
 
-	return df->sign ? -(int32_t)r : (int32_t)r;
+	return (v < 0) ? -(int32_t)r : (int32_t)r;
 }
 
-void  decfloat_set_int(decfloat *df, int32_t value){
-	if(value < 0){
-		df->mantissa = -value;
-		df->sign     = 1;
-	}else{
-		df->mantissa = value;
-		df->sign     = 0;
+/// store a number read by the gcode parser.
+/// \param mantissa all digits read, without decimal point
+/// \param exponent 0 if there was no decimal point, else 1 + number of digits after it
+/// \param sign 1 for negative numbers
+void  decfloat_set_digits(decfloat *df, uint32_t mantissa, uint8_t exponent, uint8_t sign) {
+	uint8_t		e = exponent ? exponent - 1 : 0;
+	uint32_t	r;
+
+	r = e ? (mantissa + powers[e] / 2) / powers[e] : mantissa;
+	df->asint = sign ? -(int32_t)r : (int32_t)r;
+
+	// the parser passes one digit more than we keep, for rounding
+	r = mantissa;
+	if (e > DECFLOAT_DIGITS) {
+		r = (r + powers[e - DECFLOAT_DIGITS] / 2) / powers[e - DECFLOAT_DIGITS];
+		e = DECFLOAT_DIGITS;
 	}
-	df->exponent = 0;
+	if (r > INT32_MAX / powers[DECFLOAT_DIGITS - e])
+		r = INT32_MAX;
+	else
+		r *= powers[DECFLOAT_DIGITS - e];
+	df->value = sign ? -(int32_t)r : (int32_t)r;
+}
+
+void  decfloat_set_int(decfloat *df, int32_t value) {
+	df->asint = value;
+	if (value > INT32_MAX / DECFLOAT_ONE)
+		df->value = INT32_MAX;
+	else if (value < -(INT32_MAX / DECFLOAT_ONE))
+		df->value = -INT32_MAX;
+	else
+		df->value = value * DECFLOAT_ONE;
 }
@@ -1,39 +1,60 @@
 #ifndef UTILS_H
 #define UTILS_H
 
-/// this is a very crude decimal-based floating point structure.
-/// a real floating point would at least have signed exponent.\n
-/// resulting value is \f$ mantissa * 10^{-(exponent - 1)} * ((sign * 2) - 1)\f$
+#include <stdint.h>
+
+/// number of decimals kept by decfloat, 4 gives 0.1 um for millimeters and 2.54 um for inches
+#define	DECFLOAT_DIGITS 4
+/// 1.0 in decfloat.value
+#define	DECFLOAT_ONE    10000L
+
+/// a parsed number, converted once while parsing.
+/// value is fixed point with DECFLOAT_DIGITS decimals, range +-214748.3647 (saturating).
+/// asint is the value rounded to an integer, exact up to the full 32 bit range, which line
+/// numbers and the like need.
 typedef struct {
-	uint32_t	mantissa;		///< the actual digits of our floating point number
-	uint8_t	exponent	:7;	///< scale mantissa by \f$10^{-exponent}\f$
-	uint8_t	sign			:1; ///< positive or negative?
+	int32_t	value;			///< number * DECFLOAT_ONE
+	int32_t	asint;			///< number rounded half away from zero
 } decfloat;
 
 /*
-	decfloat_to_int() is the weakest subject to variable overflow. For evaluation, we assume a build room of +-1000 mm and STEPS_PER_MM_x between 1.000 and 4096. Accordingly for metric units:
-
-		df->mantissa:  +-0..1048075    (20 bit - 500 for rounding)
-		df->exponent:  0, 2, 3, 4 or 5 (10 bit)
-		multiplicand:  1000            (10 bit)
+	decfloat_scale() does value * multiplicand / DECFLOAT_ONE in 32 bit, after taking common
+	factors of ten out of both. This keeps the multiplication in range for the usual units:
 
-	imperial units:
-
-		df->mantissa:  +-0..32267      (15 bit - 500 for rounding)
-		df->exponent:  0, 2, 3, 4 or 5 (10 bit)
-		multiplicand:  25400           (15 bit)
+		multiplicand 1000 (mm to um):      any value, a division by 10
+		multiplicand 25400 (inches to um): value up to +-845 inches
+		multiplicand 4 (quarter degrees):  any value
+		multiplicand 1024 (PID_SCALE):     value up to +-209
 */
-// decfloat_to_int() can handle a bit more:
-#define	DECFLOAT_EXP_MAX 3 // more is pointless, as 1 um is our presision
-// (2^^32 - 1) / multiplicand - powers[DECFLOAT_EXP_MAX] / 2 =
-// 4294967295 / 1000 - 5000 =
-#define	DECFLOAT_MANT_MM_MAX 4289967  // = 4290 mm
-// 4294967295 / 25400 - 5000 =
-#define	DECFLOAT_MANT_IN_MAX 164093   // = 164 inches = 4160 mm
-
-int32_t decfloat_to_int(decfloat *df, uint16_t multiplicand);
+
+/// add a digit read by the gcode parser to mantissa, see decfloat_set_digits().
+/// After the decimal point this keeps one digit more than decfloat does, for rounding, and
+/// drops any digit which would overflow mantissa, e.g. the last one of E43000.12345.
+static inline void decfloat_add_digit(uint32_t *mantissa, uint8_t *exponent, uint8_t digit) {
+	if (*exponent) {
+		if (*exponent >= DECFLOAT_DIGITS + 2 || *mantissa > (UINT32_MAX - 9) / 10)
+			return;
+		(*exponent)++;
+	}
+	// this is simply mantissa = (mantissa * 10) + digit in different clothes
+	*mantissa = (*mantissa << 3) + (*mantissa << 1) + digit;
+}
+
+int32_t decfloat_scale(decfloat *df, uint16_t multiplicand);
+void    decfloat_set_digits(decfloat *df, uint32_t mantissa, uint8_t exponent, uint8_t sign);
 void    decfloat_set_int(decfloat *df, int32_t value);
 
+/// convert a parsed number into an integer scaled by multiplicand.
+/// Plain integers are a read of the cached value, other constant multiplicands reduce their
+/// factors of ten at compile time.
+static inline int32_t decfloat_to_int(decfloat *df, uint16_t multiplicand) {
+	if (multiplicand == 1)
+		return df->asint;
+	if (multiplicand == DECFLOAT_ONE)
+		return df->value;
+	return decfloat_scale(df, multiplicand);
+}
+
 #define MIN(a,b)  ((a < b) ? a : b)
 #define MAX(a,b)  ((a < b) ? b : a)
 